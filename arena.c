@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN(size) (((size) + 15) & ~(size_t)15)
+
+static inline uint8_t* blockData(ArenaBlock* block) {
+  return (uint8_t*)block + ARENA_ALIGN(sizeof(ArenaBlock));
+}
+
+void initArena(Arena* arena) {
+  arena->blocks = NULL;
+  arena->bytes = 0;
+}
+
+void freeArena(Arena* arena) {
+  ArenaBlock* block = arena->blocks;
+  while (block != NULL) {
+    ArenaBlock* next = block->next;
+    free(block);
+    block = next;
+  }
+  initArena(arena);
+}
+
+// rewinds to empty, keeping the newest (largest) block for the next round
+void resetArena(Arena* arena) {
+  ArenaBlock* keep = arena->blocks;
+  if (keep == NULL) return;
+
+  ArenaBlock* block = keep->next;
+  while (block != NULL) {
+    ArenaBlock* next = block->next;
+    free(block);
+    block = next;
+  }
+  keep->next = NULL;
+  keep->used = 0;
+  keep->last = 0;
+  arena->blocks = keep;
+  arena->bytes = keep->capacity;
+}
+
+static ArenaBlock* newBlock(Arena* arena, size_t size) {
+  size_t capacity = ARENA_BLOCK_SIZE;
+  if (arena->blocks != NULL) capacity = arena->blocks->capacity * 2;
+  while (capacity < size) capacity *= 2;
+
+  ArenaBlock* block = (ArenaBlock*)malloc(ARENA_ALIGN(sizeof(ArenaBlock)) + capacity);
+  if (block == NULL) return NULL;
+  block->capacity = capacity;
+  block->used = 0;
+  block->last = 0;
+  block->next = arena->blocks;
+  arena->blocks = block;
+  arena->bytes += capacity;
+  return block;
+}
+
+static void* arenaAllocate(Arena* arena, size_t size) {
+  size = ARENA_ALIGN(size);
+  ArenaBlock* block = arena->blocks;
+  if (block == NULL || block->capacity - block->used < size) {
+    block = newBlock(arena, size);
+    if (block == NULL) return NULL;
+  }
+  block->last = block->used;
+  block->used += size;
+  return blockData(block) + block->last;
+}
+
+/*
+  Same contract as reallocate, minus the freeing. The newest allocation
+  grows in place when the block has room, which is the common case for
+  the growable arrays (chunks, constant pools) written while compiling.
+  Returns NULL when a new block could not be reserved.
+*/
+void* arenaReallocate(Arena* arena, void* pointer, size_t oldSize, size_t newSize) {
+  if (newSize == 0) return NULL;
+  if (newSize <= oldSize) return pointer;
+
+  ArenaBlock* block = arena->blocks;
+  if (pointer != NULL && block != NULL
+      && (uint8_t*)pointer == blockData(block) + block->last
+      && block->last + ARENA_ALIGN(newSize) <= block->capacity) {
+    block->used = block->last + ARENA_ALIGN(newSize);
+    return pointer;
+  }
+
+  void* result = arenaAllocate(arena, newSize);
+  if (result != NULL && pointer != NULL) memcpy(result, pointer, oldSize);
+  return result;
+}
@@ -0,0 +1,27 @@
+#ifndef mu_arena_h
+#define mu_arena_h
+
+#include "common.h"
+
+/*
+  Bump allocator for memory that is released all at once.
+  Nothing in an arena is freed on its own; freeArena drops every block.
+*/
+typedef struct ArenaBlock {
+  struct ArenaBlock* next;
+  size_t capacity;
+  size_t used;
+  size_t last; // offset of the most recent allocation, so it can grow in place
+} ArenaBlock;
+
+typedef struct {
+  ArenaBlock* blocks; // newest block first
+  size_t bytes;       // total reserved by all blocks
+} Arena;
+
+void initArena(Arena* arena);
+void freeArena(Arena* arena);
+void resetArena(Arena* arena);
+void* arenaReallocate(Arena* arena, void* pointer, size_t oldSize, size_t newSize);
+
+#endif
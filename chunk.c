@@ -1,7 +1,6 @@
 #include <stdlib.h>
 #include "chunk.h"
 #include "memory.h"
-#include "vm.h" // Garbage Collection
 
 void initChunk(Chunk* chunk) {
   chunk->count = 0;
@@ -9,6 +8,10 @@ void initChunk(Chunk* chunk) {
   chunk->code = NULL;
   chunk->lines = NULL;
   initValueArray(&chunk->constantPool);
+  chunk->cacheCount = 0;
+  chunk->caches = NULL;
+  chunk->callCacheCount = 0;
+  chunk->callCaches = NULL;
 }
 
 void freeChunk(Chunk* chunk) {
@@ -16,15 +19,18 @@ void freeChunk(Chunk* chunk) {
   FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
   FREE_ARRAY(int, chunk->lines, chunk->capacity);
   freeValueArray(&chunk->constantPool);
+  FREE_ARRAY(PropertyCache, chunk->caches, chunk->cacheCount);
+  FREE_ARRAY(CallCache, chunk->callCaches, chunk->callCacheCount);
   initChunk(chunk);
 }
 
 void writeChunk(Chunk* chunk, uint8_t byte, int line) {
   if (chunk->capacity < chunk->count + 1) {
     int oldCapacity = chunk->capacity;
-    chunk->capacity = GROW_CAPACITY(oldCapacity);
-    chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
-    chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, chunk->capacity);
+    int capacity = GROW_CAPACITY(oldCapacity); // only commit once both arrays grew
+    chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, capacity);
+    chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, capacity);
+    chunk->capacity = capacity;
   }
 
   chunk->code[chunk->count] = byte;
@@ -32,9 +38,26 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line) {
   chunk->count++;
 }
 
+// one more (empty) property cache, grown a slot at a time while compiling
+int addCache(Chunk* chunk) {
+  chunk->caches = GROW_ARRAY(PropertyCache, chunk->caches,
+      chunk->cacheCount, chunk->cacheCount + 1);
+  PropertyCache* cache = &chunk->caches[chunk->cacheCount];
+  for (int i = 0; i < CACHE_WAYS; i++) {
+    cache->definitions[i] = NULL;
+    cache->slots[i] = 0;
+  }
+  return chunk->cacheCount++;
+}
+
+int addCallCache(Chunk* chunk) {
+  chunk->callCaches = GROW_ARRAY(CallCache, chunk->callCaches,
+      chunk->callCacheCount, chunk->callCacheCount + 1);
+  chunk->callCaches[chunk->callCacheCount] = (CallCache){NULL, false};
+  return chunk->callCacheCount++;
+}
+
 int addConstant(Chunk* chunk, Value value) {
-  push(value); // Garbage Collection add-constant-push
-  writeValueArray(&chunk->constantPool, value);
-  pop(); // Garbage Collection add-constant-pop
+  writeValueArray(&chunk->constantPool, value); // compiler arena, nothing to collect
   return chunk->constantPool.count - 1;
 }
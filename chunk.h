@@ -19,6 +19,13 @@ typedef enum {
 // Local Variable operations
   OP_GET_LOCAL,
   OP_SET_LOCAL,
+// Compound assignment to a local in place, slot then maybe a constant operand
+  OP_ADD_LOCAL,
+  OP_ADD_LOCAL_CONSTANT,
+  OP_MULTIPLY_LOCAL,
+  OP_MULTIPLY_LOCAL_CONSTANT,
+  OP_CONCATENATE_LOCAL,
+  OP_CONCATENATE_LOCAL_CONSTANT,
 // Mutable Variables
   OP_DEFINE_MUTABLE,
   OP_SET_MUTABLE,
@@ -41,6 +48,7 @@ typedef enum {
   OP_DIVIDE,
   OP_MODULO,
   OP_CONCATENATE,
+  OP_CONCATENATE_N,
   OP_BIT_AND,
   OP_BIT_OR,
   OP_BIT_XOR,
@@ -54,28 +62,77 @@ typedef enum {
   OP_JUMP,
   OP_JUMP_IF_FALSE,
   OP_JUMP_IF_TRUE,
+  OP_POP_JUMP_IF_FALSE,
+  OP_POP_JUMP_IF_TRUE,
+// Compare and branch, both operands are popped, in pairs of a test and its opposite
+  OP_JUMP_IF_LESS,
+  OP_JUMP_IF_NOT_LESS,
+  OP_JUMP_IF_GREATER,
+  OP_JUMP_IF_NOT_GREATER,
+  OP_JUMP_IF_EQUAL,
+  OP_JUMP_IF_NOT_EQUAL,
   OP_LOOP,
-  OP_QUIT,
-  OP_QUIT_END,
+  OP_FOR_STEP, // slot, step constant, < or >, the result that loops, then a 16 bit jump back
+  OP_SWITCH, // table constant, then a 16 bit jump taken when nothing matches
 // Calls and Functions op-call
   OP_CALL,
   OP_INVOKE,
   OP_CLOSURE,
   OP_CLOSE_UPVALUE,
   OP_RETURN,
+// Instances, name constant then a 16 bit cache index
+  OP_GET_PROPERTY,
+  OP_SET_PROPERTY,
+// Instances, field index then name constant
+  OP_GET_FIELD,
+  OP_SET_FIELD,
+// Arrays
+  OP_ARRAY,
+  OP_GET_INDEX,
+  OP_SET_INDEX,
+  OP_LENGTH,
+  OP_MAP,
 } OpCode;
 
+/*
+  A field access the compiler could not resolve to an index caches the
+  last few structures it saw and the slot the field sat at in each, so a
+  hit is a compare and a load.
+*/
+#define CACHE_WAYS 4
+
+typedef struct {
+  struct ObjClass* definitions[CACHE_WAYS]; // NULL for an unused way
+  int slots[CACHE_WAYS];
+} PropertyCache;
+
+/*
+  A call site remembers the closure or native it last called. The site's
+  argument count never changes, so a closure that once passed the arity
+  check here always will, a hit goes straight to pushing its frame.
+*/
+typedef struct {
+  Obj* callee;   // NULL until the site has made a call
+  bool isNative;
+} CallCache;
+
 typedef struct {
   int count;
   int capacity;
   uint8_t* code;
   int* lines;
   ValueArray constantPool;
+  int cacheCount;
+  PropertyCache* caches; // indexed by the site's operand
+  int callCacheCount;
+  CallCache* callCaches;  // likewise, one per OP_CALL
 } Chunk;
 
 void initChunk(Chunk* chunk);
 void freeChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
 int addConstant(Chunk* chunk, Value value);
+int addCache(Chunk* chunk);
+int addCallCache(Chunk* chunk);
 
 #endif
@@ -4,6 +4,7 @@
 
 #include "common.h"
 #include "compiler.h"
+#include "map.h"
 #include "memory.h" // Garbage Collection compiler-include-memory
 #include "scanner.h"
 #include "parser.h"
@@ -14,10 +15,64 @@
 #endif
 
 #define ARG_LIMIT 255
+#define DENSE_SLACK 8 // gaps a dense switch table may have beyond two per arm
+#define INLINE_LIMIT 24 // bytes of body a function may have and still be inlined
 Compiler* current = NULL;
 
+#define UNKNOWN_TYPE ((StaticType){-1, -1})
+
+// the structures declared so far and the globals known to hold them, reset by compile()
+static Layout* layouts = NULL;
+static int layoutCount = 0;
+static TypedGlobal* typedGlobals = NULL;
+static int typedGlobalCount = 0;
+
+// the static type of the expression that ended at typedEnd in typedChunk
+static StaticType lastType;
+static int typedEnd = -1;
+static Chunk* typedChunk = NULL;
+
+// the constant that was compiled from knownStart to knownEnd in knownChunk, see emitKnown
+static Value knownValue;
+static int knownStart = -1;
+static int knownEnd = -1;
+static int knownPool = 0; // the constant pool's count before it
+static Chunk* knownChunk = NULL;
+static int leftStart = -1; // where the left operand of the infix being compiled starts
+
+// the comparison that ended at comparisonEnd in comparisonChunk, a condition fuses it into its jump
+static Lexeme comparison;
+static int comparisonEnd = -1;
+static Chunk* comparisonChunk = NULL;
+
+// where the last compound assignment to a local read its slot back, see emitCompoundLocal
+static int reloadEnd = -1;
+static Chunk* reloadChunk = NULL;
+
+// the inlinable function last read, from start to end with its name added at pool, see inlineCall
+static Callee callee;
+static Chunk* calleeChunk = NULL;
+
 // getter
 static Chunk* currentChunk() { return &current->function->chunk; }
+
+static void setExpressionType(StaticType type) {
+  lastType = type;
+  typedEnd = currentChunk()->count;
+  typedChunk = currentChunk();
+}
+
+static void setComparison(Lexeme operator) {
+  comparison = operator;
+  comparisonEnd = currentChunk()->count;
+  comparisonChunk = currentChunk();
+}
+
+// the type of the expression just compiled, unknown once anything was emitted after it
+static StaticType expressionType() {
+  if (typedChunk == currentChunk() && typedEnd == currentChunk()->count) return lastType;
+  return UNKNOWN_TYPE;
+}
 static void beginScope() { current->scopeDepth++; }
 static void emitByte(uint8_t byte) { writeChunk(currentChunk(), byte, secondToken().line); } // TODO figure out why ! = segfaults
 
@@ -56,6 +111,65 @@ static void patchJump(int offset) {
 
   currentChunk()->code[offset] = (jump >> 8) & 0xff;
   currentChunk()->code[offset + 1] = jump & 0xff;
+  comparisonChunk = NULL; // a jump lands after the comparison, its value must reach the condition
+  reloadChunk = NULL; // a jump lands after the reload, it has to stay
+}
+
+static void initJumpList(JumpList* jumps) {
+  jumps->offsets = NULL;
+  jumps->count = 0;
+  jumps->capacity = 0;
+}
+
+static void addJump(JumpList* jumps, int offset) {
+  if (jumps->capacity < jumps->count + 1) {
+    int oldCapacity = jumps->capacity;
+    jumps->capacity = GROW_CAPACITY(oldCapacity);
+    jumps->offsets = GROW_ARRAY(int, jumps->offsets, oldCapacity, jumps->capacity);
+  }
+  jumps->offsets[jumps->count++] = offset;
+}
+
+// from's jumps now land wherever to's do
+static void moveJumps(JumpList* to, JumpList* from) {
+  for (int i = 0; i < from->count; i++) {
+    addJump(to, from->offsets[i]);
+  }
+  from->count = 0;
+}
+
+// every jump in the list lands here
+static void patchJumps(JumpList* jumps) {
+  for (int i = 0; i < jumps->count; i++) {
+    patchJump(jumps->offsets[i]);
+  }
+  jumps->count = 0;
+}
+
+static void beginQuittable(Quittable* quittable) {
+  quittable->enclosing = current->quittable;
+  quittable->scopeDepth = current->scopeDepth;
+  initJumpList(&quittable->exits);
+  current->quittable = quittable;
+}
+
+// every exit of the innermost loop or when lands here
+static void endQuittable() {
+  patchJumps(&current->quittable->exits);
+  current->quittable = current->quittable->enclosing;
+}
+
+static void emitQuit() {
+  Quittable* quittable = current->quittable;
+  if (quittable == NULL) {
+    error("Can't use 'quit' outside of a loop or when block.");
+    return;
+  }
+  for (int i = current->localCount - 1;
+       i >= 0 && current->locals[i].depth > quittable->scopeDepth; i--) {
+    emitByte(current->locals[i].isCaptured ? OP_CLOSE_UPVALUE : OP_POP);
+  }
+  addJump(&quittable->exits, emitJump(OP_JUMP));
 }
 
 static void emitReturn() {
@@ -87,7 +201,37 @@ static uint8_t makeConstant(Value value) {
 }
 
 static void emitConstant(Value value) { emitBytes(OP_CONSTANT, makeConstant(value)); }
-static uint8_t identifierConstant(Token* token) { return makeConstant(OBJ_VAL(copyString(token->start, token->length))); }
+
+// a value known while compiling, it can be folded into an operator or stand in for a global
+static void emitKnown(Value value) {
+  knownStart = currentChunk()->count;
+  knownPool = currentChunk()->constantPool.count;
+  if (IS_NIL(value)) {
+    emitByte(OP_NIL);
+  } else if (IS_BOOL(value)) {
+    emitByte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+  } else {
+    emitConstant(value);
+  }
+  knownValue = value;
+  knownEnd = currentChunk()->count;
+  knownChunk = currentChunk();
+}
+
+// whether the code from start on is nothing but a known value
+static bool isKnown(int start, Value* value) {
+  if (knownChunk != currentChunk() || knownStart != start
+      || knownEnd != currentChunk()->count) return false;
+  *value = knownValue;
+  return true;
+}
+
+// takes back everything from start on, along with the constants it added
+static void unemit(int start, int pool) {
+  currentChunk()->count = start;
+  currentChunk()->constantPool.count = pool;
+}
+static uint8_t identifierConstant(Token* token) { return makeConstant(copyText(token->start, token->length)); }
 
 static bool identifiersEqual(Token* a, Token* b) {
   if (a->length != b->length) { return false; }
@@ -113,9 +257,9 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
   compiler->type = type;
   compiler->localCount = 0;
   compiler->scopeDepth = 0;
+  compiler->quittable = NULL;
   compiler->function = newFunction();
   current = compiler;
-  initTable(&current->identifierTypes); // TODO use table to static type checking
 
   if (type != FT_SCRIPT)
   { current->function->name = copyString(secondToken().start, secondToken().length); }
@@ -123,6 +267,7 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
   Local* local = &current->locals[current->localCount++];
   local->depth = 0;
   local->isCaptured = false;
+  local->type = UNKNOWN_TYPE;
 
   if (type != FT_FUNCTION) {
     local->name.start = "self"; // TODO implement structs with methods
@@ -196,6 +341,7 @@ static void addLocal(Token name) {
   local->name = name;
   local->depth = -1;
   local->isCaptured = false;
+  local->type = UNKNOWN_TYPE;
 }
 
 static void checkLocals() {
@@ -228,6 +374,61 @@ static uint8_t parseVariable(const char* errorMessage) {
   return identifierConstant(&prior);
 }
 
+static int findTypedGlobal(Token* name) {
+  for (int i = typedGlobalCount - 1; i >= 0; i--) {
+    if (identifiersEqual(&typedGlobals[i].name, name)) return i;
+  }
+  return -1;
+}
+
+static StaticType globalType(Token* name) {
+  int global = findTypedGlobal(name);
+  return global == -1 ? UNKNOWN_TYPE : typedGlobals[global].type;
+}
+
+static void setGlobalType(Token* name, StaticType type) {
+  int global = findTypedGlobal(name);
+  if (global == -1) {
+    typedGlobals = GROW_ARRAY(TypedGlobal, typedGlobals, typedGlobalCount, typedGlobalCount + 1);
+    global = typedGlobalCount++;
+    typedGlobals[global].name = *name;
+    typedGlobals[global].isKnown = false;
+    typedGlobals[global].inlined = NULL;
+  }
+  typedGlobals[global].type = type;
+}
+
+// the constant an immutable global was set to, false when it isn't one
+static bool globalValue(Token* name, Value* value) {
+  int global = findTypedGlobal(name);
+  if (global == -1 || !typedGlobals[global].isKnown) return false;
+  *value = typedGlobals[global].value;
+  return true;
+}
+
+static void setGlobalValue(Token* name, Value value) {
+  int global = findTypedGlobal(name);
+  typedGlobals[global].isKnown = true;
+  typedGlobals[global].value = value;
+}
+
+static ObjFunction* globalInlined(Token* name) {
+  int global = findTypedGlobal(name);
+  return global == -1 ? NULL : typedGlobals[global].inlined;
+}
+
+static void setGlobalInlined(Token* name, ObjFunction* function) {
+  typedGlobals[findTypedGlobal(name)].inlined = function;
+}
+
+// the index of field in layout, -1 if it is not one of its fields
+static int layoutSlot(Layout* layout, Token* field) {
+  for (int i = 0; i < layout->fieldCount; i++) {
+    if (identifiersEqual(&layout->fields[i], field)) return i;
+  }
+  return -1;
+}
+
 static void markInitialized() {
   if (current->scopeDepth == 0)
   { return; }
@@ -246,14 +447,51 @@ static void defineConstant(uint8_t global) { // Currently assigns constants
 static void resolveExpression(Precedence precedence);
 static ParseRule* getRule(Lexeme glyph);
 
+// the in place opcode for a compound assignment to a local, OP_POP when there is none
+static uint8_t inPlaceOp(uint8_t operation) {
+  switch (operation) {
+    case OP_ADD:         return OP_ADD_LOCAL;
+    case OP_MULTIPLY:    return OP_MULTIPLY_LOCAL;
+    case OP_CONCATENATE: return OP_CONCATENATE_LOCAL;
+    default:             return OP_POP;
+  }
+}
+
+/*
+  #local op= value updates the slot where it is, then reads it back as the
+  value of the expression. A statement drops that read instead of popping it.
+*/
+static void emitCompoundLocal(uint8_t inPlace, uint8_t slot) {
+  int start = currentChunk()->count;
+  resolveExpression(LVL_BASE);
+  if (currentChunk()->count - start == 2 && currentChunk()->code[start] == OP_CONSTANT) {
+    uint8_t constant = currentChunk()->code[start + 1];
+    currentChunk()->count = start;
+    emitBytes(inPlace + 1, slot); // each one's constant form follows it
+    emitByte(constant);
+  } else {
+    emitBytes(inPlace, slot);
+  }
+  emitBytes(OP_GET_LOCAL, slot);
+  reloadEnd = currentChunk()->count;
+  reloadChunk = currentChunk();
+}
+
 static void emitCompound(uint8_t operation, uint8_t byte1, uint8_t byte2, uint8_t target) {
   advance();
+  if (byte1 == OP_GET_LOCAL && inPlaceOp(operation) != OP_POP) {
+    return emitCompoundLocal(inPlaceOp(operation), target);
+  }
   emitBytes(byte1, target);
   resolveExpression(LVL_BASE); // gathers everything to the right of operator.
   emitByte(operation);
   emitBytes(byte2, target);
 }
 
+static void skipNewlines() {
+  while (consume(S_SEMICOLON)) {}
+}
+
 static uint8_t argumentList() {
   uint8_t argCount = 0;
   if (tokenIsNot(SR_ROUND)) {
@@ -283,13 +521,66 @@ static void orJump(bool unused) {
   patchJump(endJump);
 }
 
-static void structure(bool canAssign) {} // TODO implement
+
+// a .. b .. c joins every operand in one instruction, not one per '..'
+static void concatenation(Precedence operand) {
+  int count = 2;
+  while (tokenIs(D_DOT)) {
+    advance();
+    resolveExpression(operand);
+    if (++count > UINT8_MAX) error("Can't concatenate more than 255 operands at once.");
+  }
+
+  if (count == 2) {
+    emitByte(OP_CONCATENATE);
+  } else {
+    emitBytes(OP_CONCATENATE_N, (uint8_t)count);
+  }
+}
+
+// left op right worked out while compiling, exactly as the VM would, false when it isn't folded
+static bool fold(Lexeme operator, Value left, Value right, Value* result) {
+  if (!IS_NUMBER(left) || !IS_NUMBER(right)) return false;
+  int32_t whole;
+  bool integers = IS_INTEGER(left) && IS_INTEGER(right);
+  switch (operator) {
+    case S_PLUS:
+      *result = integers && !__builtin_add_overflow(AS_INTEGER(left), AS_INTEGER(right), &whole)
+          ? INTEGER_VAL(whole) : NUMBER_VAL(AS_NUMBER(left) + AS_NUMBER(right));
+      return true;
+    case S_MINUS:
+      *result = integers && !__builtin_sub_overflow(AS_INTEGER(left), AS_INTEGER(right), &whole)
+          ? INTEGER_VAL(whole) : NUMBER_VAL(AS_NUMBER(left) - AS_NUMBER(right));
+      return true;
+    case S_STAR:
+      *result = integers && !__builtin_mul_overflow(AS_INTEGER(left), AS_INTEGER(right), &whole)
+          ? INTEGER_VAL(whole) : NUMBER_VAL(AS_NUMBER(left) * AS_NUMBER(right));
+      return true;
+    case S_SLASH:
+      *result = NUMBER_VAL(AS_NUMBER(left) / AS_NUMBER(right));
+      return true;
+    default:
+      return false;
+  }
+}
 
 static void binary(bool canAssign) {
   Lexeme operator = secondToken().lexeme;
   ParseRule* rule = getRule(operator);    // get the precedence
+  int start = leftStart;
+  Value left;
+  bool leftKnown = start != -1 && isKnown(start, &left);
+  int pool = knownPool;
+  int rightStart = currentChunk()->count;
   resolveExpression((Precedence)(rule->precedence + 1)); // apply the precedence
 
+  Value right, result;
+  if (leftKnown && isKnown(rightStart, &right) && fold(operator, left, right, &result)) {
+    unemit(start, pool);
+    emitKnown(result);
+    return;
+  }
+
   switch (operator) {
     case D_BANG_TILDE:    emitBytes(OP_EQUAL, OP_NOT);
       break;
@@ -303,7 +594,7 @@ static void binary(bool canAssign) {
       break;
     case D_LESS_EQUAL:    emitBytes(OP_GREATER, OP_NOT);
       break;
-    case D_DOT:           emitByte(OP_CONCATENATE);
+    case D_DOT:           concatenation((Precedence)(rule->precedence + 1));
       break;
     case S_PLUS:          emitByte(OP_ADD);
       break;
@@ -323,11 +614,260 @@ static void binary(bool canAssign) {
       break;
     default: return; // Unreachable.
   }
+  if (rule->precedence == LVL_EQUAL || rule->precedence == LVL_COMPARE) {
+    setComparison(operator);
+  }
+}
+
+// argument count and a fresh call cache, the operands of OP_CALL
+static void emitCall(uint8_t argCount) {
+  int cache = addCallCache(currentChunk());
+  if (cache > UINT16_MAX) error("Too many calls in one function.");
+  emitBytes(OP_CALL, argCount);
+  emitBytes((cache >> 8) & 0xff, cache & 0xff);
 }
 
+//> Inlining
+// the length of a straight line instruction inlineCall can copy, 0 for any other
+static int inlineLength(uint8_t instruction) {
+  switch (instruction) {
+    case OP_NIL: case OP_TRUE: case OP_FALSE:
+    case OP_EQUAL: case OP_GREATER: case OP_LESS:
+    case OP_ADD: case OP_SUBTRACT: case OP_MULTIPLY: case OP_DIVIDE: case OP_MODULO:
+    case OP_CONCATENATE: case OP_BIT_AND: case OP_BIT_OR: case OP_BIT_XOR:
+    case OP_NOT: case OP_NEGATE: case OP_FLIP_BITS: case OP_LENGTH:
+      return 1;
+    case OP_CONSTANT: case OP_GET_LOCAL: case OP_GET_GLOBAL: case OP_GET_UPVALUE:
+      return 2;
+    case OP_GET_FIELD:
+      return 3;
+    default:
+      return 0;
+  }
+}
+
+/*
+  The function the code from start on closes over, when its calls can be
+  replaced by its body: no upvalues, and a body that is one small returned
+  expression of reads and operators. With no calls in it the function
+  can't be recursive, and nothing in it has an effect. An operator can
+  still fail, the error then gives the body's line but not its frame.
+*/
+static ObjFunction* inlinable(int start) {
+  Chunk* chunk = currentChunk();
+  if (chunk->count != start + 2 || chunk->code[start] != OP_CLOSURE) return NULL;
+  ObjFunction* function = AS_FUNCTION(chunk->constantPool.values[chunk->code[start + 1]]);
+  Chunk* body = &function->chunk;
+
+  for (int offset = 0; offset < body->count && offset <= INLINE_LIMIT;) {
+    uint8_t instruction = body->code[offset];
+    if (instruction == OP_RETURN) return offset > 0 ? function : NULL;
+    int length = inlineLength(instruction);
+    if (length == 0 || instruction == OP_GET_UPVALUE) return NULL;
+    if (instruction == OP_GET_LOCAL
+        && (body->code[offset + 1] == 0 || body->code[offset + 1] > function->arity)) {
+      return NULL; // the closure itself, or a local of the body's own
+    }
+    offset += length;
+  }
+  return NULL;
+}
+
+// the constant of the inlined body in this chunk, each added once a call
+static uint8_t inlineConstant(Value* pool, int* added, uint8_t constant) {
+  if (added[constant] == -1) added[constant] = makeConstant(pool[constant]);
+  return (uint8_t)added[constant];
+}
+
+/*
+  name(arguments) where name was the inlinable function read by callee and
+  every argument a single read. The callee and the arguments are taken
+  back out, then the body goes in with its parameters replaced by the
+  arguments' reads. Any other call is left as it is.
+*/
+static bool inlineCall(Callee callee, int argCount) {
+  Chunk* chunk = currentChunk();
+  if (chunk->count - callee.end > 2 * argCount || argCount != callee.function->arity) return false;
+  uint8_t arguments[2 * ARG_LIMIT];
+  int lengths[ARG_LIMIT];
+  int count = 0;
+  for (int offset = callee.end; offset < chunk->count; count++) {
+    uint8_t instruction = chunk->code[offset];
+    if (count == argCount || (instruction != OP_CONSTANT && instruction != OP_GET_LOCAL
+        && instruction != OP_GET_GLOBAL && instruction != OP_GET_UPVALUE
+        && instruction != OP_NIL && instruction != OP_TRUE && instruction != OP_FALSE)) {
+      return false;
+    }
+    lengths[count] = inlineLength(instruction);
+    memcpy(&arguments[2 * count], &chunk->code[offset], lengths[count]);
+    offset += lengths[count];
+  }
+  if (count != argCount) return false;
+
+  // everything from the callee's name on is added again, only as it is used
+  Value callPool[2 * ARG_LIMIT + 1];
+  int callAdded[2 * ARG_LIMIT + 1];
+  int callPoolCount = chunk->constantPool.count - callee.pool;
+  memcpy(callPool, &chunk->constantPool.values[callee.pool], sizeof(Value) * callPoolCount);
+  for (int i = 0; i < callPoolCount; i++) callAdded[i] = -1;
+  unemit(callee.start, callee.pool);
+
+  Chunk* body = &callee.function->chunk;
+  int added[UINT8_COUNT];
+  for (int i = 0; i < body->constantPool.count; i++) added[i] = -1;
+
+  uint8_t instruction = OP_RETURN;
+  for (int offset = 0; body->code[offset] != OP_RETURN; offset += inlineLength(instruction)) {
+    instruction = body->code[offset];
+    if (instruction == OP_GET_LOCAL) { // a parameter, read the argument in its place
+      uint8_t* argument = &arguments[2 * (body->code[offset + 1] - 1)];
+      emitByte(argument[0]);
+      if (argument[0] == OP_CONSTANT || argument[0] == OP_GET_GLOBAL) {
+        emitByte(argument[1] < callee.pool ? argument[1]
+            : inlineConstant(callPool, callAdded, argument[1] - callee.pool));
+      } else if (argument[0] == OP_GET_LOCAL || argument[0] == OP_GET_UPVALUE) {
+        emitByte(argument[1]);
+      }
+    } else if (instruction == OP_CONSTANT || instruction == OP_GET_GLOBAL) {
+      emitBytes(instruction, inlineConstant(body->constantPool.values, added, body->code[offset + 1]));
+    } else if (instruction == OP_GET_FIELD) {
+      emitBytes(instruction, body->code[offset + 1]);
+      emitByte(inlineConstant(body->constantPool.values, added, body->code[offset + 2]));
+    } else {
+      emitByte(instruction);
+    }
+    if (instruction != OP_GET_LOCAL) { // errors point into the body, not at the call
+      int length = inlineLength(instruction);
+      for (int i = chunk->count - length; i < chunk->count; i++) chunk->lines[i] = body->lines[offset];
+    }
+  }
+
+  // what was tracked about the code taken back no longer holds
+  knownChunk = NULL;
+  comparisonChunk = NULL;
+  reloadChunk = NULL;
+  switch (instruction) { // but a condition can still fuse the body's last comparison
+    case OP_LESS:    setComparison(S_LESS);    break;
+    case OP_GREATER: setComparison(S_GREATER); break;
+    case OP_EQUAL:   setComparison(S_EQUAL);   break;
+    default: break;
+  }
+  return true;
+}
+//^ Inlining
+
 static void call(bool unused) {
+  StaticType type = expressionType();
+  bool inlining = calleeChunk == currentChunk() && callee.end == currentChunk()->count;
+  Callee read = callee; // the arguments may read another
   uint8_t argCount = argumentList();
-  emitBytes(OP_CALL, argCount);
+  if (!inlining || !inlineCall(read, argCount)) emitCall(argCount);
+  calleeChunk = NULL; // the result is called, never the function read before it
+  if (type.declares != -1) setExpressionType((StaticType){-1, type.declares});
+}
+
+// name constant and a fresh inline cache, the operands of a property access
+static void emitProperty(uint8_t instruction, uint8_t name) {
+  int cache = addCache(currentChunk());
+  if (cache > UINT16_MAX) error("Too many field accesses in one function.");
+  emitBytes(instruction, name);
+  emitBytes((cache >> 8) & 0xff, cache & 0xff);
+}
+
+/*
+  instance.field, instance.#field := value or instance.field(arguments).
+  When the instance is known to be built from a structure the field is
+  accessed by its index, otherwise by name through an inline cache.
+*/
+static void dot(bool canAssign) {
+  StaticType receiver = expressionType();
+  if (!consume(L_IDENTIFIER) && !consume(L_MUTABLE)) {
+    errorAtCurrent("Expect field name after '.'.");
+    return;
+  }
+  Token field = secondToken();
+  uint8_t name = identifierConstant(&field);
+  int slot = receiver.holds == -1 ? -1 : layoutSlot(&layouts[receiver.holds], &field);
+
+  if (canAssign && consume(D_COLON_EQUAL)) {
+    if (field.lexeme != L_MUTABLE) error("Only #mutable fields can be reassigned.");
+    resolveExpression(LVL_BASE);
+    if (slot != -1) {
+      emitBytes(OP_SET_FIELD, (uint8_t)slot);
+      emitByte(name);
+    } else {
+      emitProperty(OP_SET_PROPERTY, name);
+    }
+  } else if (consume(SL_ROUND)) {
+    if (slot != -1) {
+      emitBytes(OP_GET_FIELD, (uint8_t)slot);
+      emitByte(name);
+      emitCall(argumentList());
+    } else {
+      uint8_t argCount = argumentList();
+      emitProperty(OP_INVOKE, name);
+      emitByte(argCount);
+    }
+  } else if (slot != -1) {
+    emitBytes(OP_GET_FIELD, (uint8_t)slot);
+    emitByte(name);
+  } else if (field.length == 6 && memcmp(field.start, "length", 6) == 0) {
+    emitByte(OP_LENGTH);
+  } else {
+    emitProperty(OP_GET_PROPERTY, name);
+  }
+}
+
+// [a, b, c], the items may also go one per line
+static void arrayLiteral(bool unused) {
+  int count = 0;
+  skipNewlines();
+  if (tokenIsNot(SR_SQUARE)) {
+    do {
+      skipNewlines();
+      resolveExpression(LVL_BASE);
+      if (count >= ARG_LIMIT) {
+        error("Can't have more than 255 items in an array literal.");
+      }
+      count++;
+      skipNewlines();
+    } while (consume(S_COMMA));
+  }
+  require(SR_SQUARE, "Expect ']' after array items.");
+  emitBytes(OP_ARRAY, (uint8_t)count);
+}
+
+// { key: value, ... }, the pairs may also go one per line
+static void mapLiteral(bool unused) {
+  int count = 0;
+  skipNewlines();
+  if (tokenIsNot(SR_CURLY)) {
+    do {
+      skipNewlines();
+      resolveExpression(LVL_BASE);
+      require(S_COLON, "Expect ':' after map key.");
+      resolveExpression(LVL_BASE);
+      if (count >= ARG_LIMIT) {
+        error("Can't have more than 255 entries in a map literal.");
+      }
+      count++;
+      skipNewlines();
+    } while (consume(S_COMMA));
+  }
+  require(SR_CURLY, "Expect '}' after map entries.");
+  emitBytes(OP_MAP, (uint8_t)count);
+}
+
+// array[index] or map[key], either followed by := value
+static void subscript(bool canAssign) {
+  resolveExpression(LVL_BASE);
+  require(SR_SQUARE, "Expect ']' after index.");
+  if (canAssign && consume(D_COLON_EQUAL)) {
+    resolveExpression(LVL_BASE);
+    emitByte(OP_SET_INDEX);
+  } else {
+    emitByte(OP_GET_INDEX);
+  }
 }
 
 static void grouping(bool unused) {
@@ -335,19 +875,30 @@ static void grouping(bool unused) {
   require(SR_ROUND, "Expect ')' after expression.");
 }
 
+static Value numberValue(Token* token) {
+  double value = strtod(token->start, NULL);
+  // whole literals that fit are integers, so counters never touch a double
+  if (value >= INT32_MIN && value <= INT32_MAX && value == (int32_t)value) {
+    return INTEGER_VAL((int32_t)value);
+  }
+  return NUMBER_VAL(value);
+}
+
 static void number(bool unused) {
   //if (tokenIs(S_BANG)) { errorAtCurrent("Cannot follow a number with a '!'");}
     // prevents segfault
-  double value = strtod(secondToken().start, NULL);
-  emitConstant(NUMBER_VAL(value));
+  Token prior = secondToken();
+  emitKnown(numberValue(&prior));
 }
 
 static void string(bool unused) {
-  emitConstant(OBJ_VAL(copyString(secondToken().start + 1, secondToken().length - 2)));
+  emitKnown(copyText(secondToken().start + 1, secondToken().length - 2));
 }
 
 static void findVariable(Token name, bool canAssign) {
   uint8_t getOp, setOp;
+  bool constant = false;
+  Value known;
 
   int arg = resolveLocal(current, &name);
   if (arg != -1) {
@@ -359,7 +910,8 @@ static void findVariable(Token name, bool canAssign) {
   } else if (current->type != FT_SCRIPT && name.lexeme != L_IDENTIFIER) {
       error("Cannot access mutables from outside the function's scope.");
   } else {
-    arg = identifierConstant(&name);
+    constant = name.lexeme == L_IDENTIFIER && globalValue(&name, &known);
+    arg = constant ? 0 : identifierConstant(&name); // a known global is never looked up
     getOp = OP_GET_GLOBAL;
     setOp = OP_SET_GLOBAL;
   }
@@ -397,7 +949,24 @@ static void findVariable(Token name, bool canAssign) {
       default : break;
     }
   }
-  return emitBytes(getOp, (uint8_t)arg);
+  if (constant) return emitKnown(known);
+  int start = currentChunk()->count;
+  emitBytes(getOp, (uint8_t)arg);
+  ObjFunction* inlined = getOp == OP_GET_GLOBAL && name.lexeme == L_IDENTIFIER ? globalInlined(&name) : NULL;
+  if (inlined != NULL) {
+    callee.function = inlined;
+    callee.start = start;
+    callee.end = currentChunk()->count;
+    callee.pool = arg; // the name was the last constant added
+    calleeChunk = currentChunk();
+  } else {
+    calleeChunk = NULL; // any other read isn't a callee to inline
+  }
+  if (getOp == OP_GET_LOCAL) {
+    setExpressionType(current->locals[arg].type);
+  } else if (getOp == OP_GET_GLOBAL) {
+    setExpressionType(globalType(&name));
+  }
 }
 
 static void variable(bool canAssign) {
@@ -407,14 +976,18 @@ static void variable(bool canAssign) {
 
 static void compileTokens();
 
-static void block(Token *marker) { // TODO
+// gives back where its last statement starts
+static int block(Token *marker) { // TODO
+  int lastStatement = currentChunk()->count;
   while (tokenIsNot(SR_CURLY) && tokenIsNot(END_OF_FILE)) {
+    lastStatement = currentChunk()->count;
     compileTokens();
   }
   if (tokenIsNot(SR_CURLY)) {
     errorAt(marker, "Need a ,, to finish code block.");
   }
   consume(SR_CURLY);
+  return lastStatement;
 }
 
 static void anonymous(Token *marker) {
@@ -471,11 +1044,48 @@ static void buildClosure(FunctionType type) {
   }
 }
 
+// use { a, b, #c }, the fields may also go one per line
 static void buildStructure() {
-  emitByte(OP_CLASS);
-  require(SL_CURLY, "Expect { which will be changed later");
+  // as Name: use { ... } names the structure after its binding
+  Token name = fourthToken();
+  if (thirdToken().lexeme != S_COLON || name.lexeme != L_IDENTIFIER) {
+    name = secondToken();
+  }
+  uint8_t nameConstant = identifierConstant(&name);
+  require(SL_CURLY, "Expect '{' to list the structure's fields.");
 
-  require(SR_CURLY, "Expect } which will be changed later");
+  Layout layout = { NULL, 0 };
+  uint8_t names[UINT8_MAX];
+  skipNewlines();
+  while (tokenIsNot(SR_CURLY) && tokenIsNot(END_OF_FILE)) {
+    if (!consume(L_IDENTIFIER) && !consume(L_MUTABLE)) {
+      errorAtCurrent("Expect field name.");
+      break;
+    }
+    Token field = secondToken();
+    if (layoutSlot(&layout, &field) != -1) error("Already a field with this name.");
+    if (layout.fieldCount == UINT8_MAX) {
+      error("Can't have more than 255 fields.");
+      break;
+    }
+    layout.fields = GROW_ARRAY(Token, layout.fields, layout.fieldCount, layout.fieldCount + 1);
+    layout.fields[layout.fieldCount] = field;
+    names[layout.fieldCount++] = identifierConstant(&field);
+
+    if (!consume(S_COMMA) && !consume(S_SEMICOLON)) break;
+    skipNewlines();
+  }
+  require(SR_CURLY, "Expect '}' after the structure's fields.");
+
+  emitBytes(OP_CLASS, nameConstant);
+  emitByte((uint8_t)layout.fieldCount);
+  for (int i = 0; i < layout.fieldCount; i++) {
+    emitByte(names[i]);
+  }
+
+  layouts = GROW_ARRAY(Layout, layouts, layoutCount, layoutCount + 1);
+  layouts[layoutCount] = layout;
+  setExpressionType((StaticType){layoutCount++, -1});
 }
 
 static void buildReturn(bool unused) {
@@ -500,8 +1110,19 @@ static void printExpression() {   // TODO remove
 
 static void unary(bool unused) {
   Lexeme operator = secondToken().lexeme; // hold onto the operator, resolve the next expression, then emit
+  int start = currentChunk()->count;
+  int pool = currentChunk()->constantPool.count;
   resolveExpression(LVL_UNARY); // TODO part of the issue with ! = ..?
 
+  Value operand;
+  if (operator == S_MINUS && isKnown(start, &operand) && IS_NUMBER(operand)) {
+    unemit(start, pool);
+    // as OP_NEGATE does it, 0 and INT32_MIN have no int32 negation
+    emitKnown(IS_INTEGER(operand) && AS_INTEGER(operand) != 0 && AS_INTEGER(operand) != INT32_MIN
+        ? INTEGER_VAL(-AS_INTEGER(operand)) : NUMBER_VAL(-AS_NUMBER(operand)));
+    return;
+  }
+
   switch (operator) {
     case S_BANG:
       emitByte(OP_NOT);
@@ -519,17 +1140,17 @@ static void unary(bool unused) {
 
 static void literal(bool unused) {
   switch (secondToken().lexeme) {
-    case K_FALSE:   emitByte(OP_FALSE);
+    case K_FALSE:   emitKnown(BOOL_VAL(false));
       break;
-    case K_NULL:    emitByte(OP_NIL);
+    case K_NULL:    emitKnown(NIL_VAL);
       break;
-    case K_TRUE:    emitByte(OP_TRUE);
+    case K_TRUE:    emitKnown(BOOL_VAL(true));
       break;
     case K_DONE:    emitByte(OP_DONE);
         break;
     case K_FAIL:    emitByte(OP_FAIL);
         break;
-    case K_QUIT:    emitByte(OP_QUIT);
+    case K_QUIT:    emitQuit();
       break;
     case K_USE:     buildStructure();
       break;
@@ -548,10 +1169,10 @@ static void literal(bool unused) {
 
 ParseRule rules[] = {
 //                        prefix,  infix, precedence
-  [S_DOT]              = {NULL,     call, LVL_CALL}, // call struct properties?
+  [S_DOT]              = {NULL,     dot,  LVL_CALL},
   [SL_ROUND]           = {grouping, call, LVL_CALL}, // update call to infer function creation or call
-  [SL_CURLY]           = {structure,  NULL, LVL_NONE}, // {literal, NULL, LVL_NONE},
-  [SL_SQUARE]          = {NULL,     NULL, LVL_NONE}, // {literal, NULL, LVL_NONE},
+  [SL_CURLY]           = {mapLiteral, NULL, LVL_NONE},
+  [SL_SQUARE]          = {arrayLiteral, subscript, LVL_CALL},
 //^ function calls, product type declarations
   [S_MINUS]            = {unary,    binary, LVL_SUM},
   [S_PLUS]             = {NULL,     binary, LVL_SUM},
@@ -588,6 +1209,7 @@ ParseRule rules[] = {
   [K_VOID]             = {literal,  NULL,    LVL_NONE},
   [K_FUNCTION]         = {literal,  NULL,    LVL_NONE},
   [K_QUIT]             = {literal,  NULL,    LVL_NONE},
+  [K_USE]              = {literal,  NULL,    LVL_NONE},
   [D_STAR_L_ROUND]     = {literal,  NULL,    LVL_NONE},
   [K_RETURN]           = {buildReturn, NULL, LVL_NONE},
   [TOKEN_PRINT]        = {NULL, NULL, LVL_NONE},     // TODO remove after implementing function
@@ -639,12 +1261,22 @@ static void resolveInfix(Precedence hasPrecedence) {
     callInfix(hasPrecedence);
 }
 
+// the rest of an expression whose left operand is already on the stack
+static void continueExpression(Precedence level) {
+  while (level <= getRule(currentToken().lexeme)->precedence) {
+    leftStart = -1; // not known to start anywhere in particular
+    resolveInfix(false);
+  }
+}
+
 static void resolveExpression(Precedence level) {   // TODO rename handleExpression? resolveExpression?
   advance();
   bool hasPrecedence = (level <= LVL_BASE);
+  int start = currentChunk()->count;
   resolvePrefix(hasPrecedence);
 
   while (level <= getRule(currentToken().lexeme)->precedence) {
+    leftStart = start;
     resolveInfix(hasPrecedence);
   }
 
@@ -658,58 +1290,132 @@ static void resolveExpression(Precedence level) {   // TODO rename handleExpress
 static void declaration() {
   advance();
   uint8_t global = parseVariable("Expect variable name.");
+  Token name = secondToken();
+  Value value;
+  if (current->scopeDepth == 0 && (globalValue(&name, &value) || globalInlined(&name) != NULL)) {
+    error("Already a constant with this name."); // its uses so far were compiled to the first value
+  }
 
+  StaticType type = UNKNOWN_TYPE;
+  bool known = false;
+  ObjFunction* inlined = NULL;
   if (consume(S_COLON)) {
+    int start = currentChunk()->count;
     resolveExpression(LVL_BASE);
+    if (name.lexeme == L_IDENTIFIER) { // a #mutable may later hold anything
+      type = expressionType();
+      known = isKnown(start, &value);
+      inlined = inlinable(start);
+    }
   } else {
     error("Need to initialize constants. ('as' identifier':' expression ';')");
   }
+  if (current->scopeDepth > 0) {
+    current->locals[current->localCount - 1].type = type;
+  } else {
+    setGlobalType(&name, type);
+    if (known) setGlobalValue(&name, value);
+    if (inlined != NULL) setGlobalInlined(&name, inlined);
+  }
   if (previousIsNot(SR_CURLY)) {
     require(S_SEMICOLON, "Expect ':' expression ';' to create a variable declaration.");
   }
   defineConstant(global);
 }
 
+// the compare and branch for the comparison just compiled, OP_POP when it didn't end in one
+static uint8_t comparisonJump(bool jumpWhen) {
+  if (comparisonChunk != currentChunk() || comparisonEnd != currentChunk()->count) return OP_POP;
+  switch (comparison) {
+    case S_LESS:          return jumpWhen ? OP_JUMP_IF_LESS : OP_JUMP_IF_NOT_LESS;
+    case D_GREATER_EQUAL: return jumpWhen ? OP_JUMP_IF_NOT_LESS : OP_JUMP_IF_LESS;
+    case S_GREATER:       return jumpWhen ? OP_JUMP_IF_GREATER : OP_JUMP_IF_NOT_GREATER;
+    case D_LESS_EQUAL:    return jumpWhen ? OP_JUMP_IF_NOT_GREATER : OP_JUMP_IF_GREATER;
+    case S_EQUAL:         return jumpWhen ? OP_JUMP_IF_EQUAL : OP_JUMP_IF_NOT_EQUAL;
+    case D_BANG_TILDE:    return jumpWhen ? OP_JUMP_IF_NOT_EQUAL : OP_JUMP_IF_EQUAL;
+    default:              return OP_POP;
+  }
+}
+
+// jumps when the value just compiled comes out as jumpWhen, it is off the stack either way
+static int emitConditionJump(bool jumpWhen) {
+  uint8_t fused = comparisonJump(jumpWhen);
+  if (fused == OP_POP) {
+    return emitJump(jumpWhen ? OP_POP_JUMP_IF_TRUE : OP_POP_JUMP_IF_FALSE);
+  }
+  bool negated = comparison == D_GREATER_EQUAL || comparison == D_LESS_EQUAL
+              || comparison == D_BANG_TILDE;
+  currentChunk()->count -= negated ? 2 : 1; // the comparison and its OP_NOT become the jump
+  return emitJump(fused);
+}
+
+/*
+  A condition as branches alone, no truth value is left on the stack.
+  Control goes to jumps when the whole of it comes out as jumpWhen and falls
+  through otherwise. 'and' binds tighter than 'or', so it is a chain of 'or'
+  terms that are each a chain of 'and' factors. Whether a factor is the last
+  of its term, or the term the last of the condition, is only known from the
+  token after it, so its jump is chosen once that token is seen.
+*/
+static void jumpCondition(bool jumpWhen, JumpList* jumps) {
+  JumpList isTrue;  // an 'or' term came out true
+  JumpList isFalse; // an 'and' factor came out false
+  initJumpList(&isTrue);
+  initJumpList(&isFalse);
+
+  for (;;) {
+    resolveExpression(LVL_AND + 1);
+    if (consume(K_AND)) {
+      addJump(&isFalse, emitConditionJump(false));
+      continue;
+    }
+    if (consume(K_OR)) {
+      addJump(&isTrue, emitConditionJump(true));
+      patchJumps(&isFalse); // on to the next term
+      continue;
+    }
+    addJump(jumps, emitConditionJump(jumpWhen));
+    break;
+  }
+
+  moveJumps(jumps, jumpWhen ? &isTrue : &isFalse);
+  patchJumps(jumpWhen ? &isFalse : &isTrue); // falling through
+}
+
 static void unlessStatement(OpCode condition) {
   advance();
-  resolveExpression(LVL_BASE);
+  JumpList skip;
+  initJumpList(&skip);
+  jumpCondition(condition == OP_JUMP_IF_TRUE, &skip);
   Token errorMarker = currentToken();
   require(SL_CURLY, "Expect a '{' after BOOLEAN test condition.");
   beginScope();
-  int thenJump = emitJump(condition);
 
-  emitByte(OP_POP); // then
   // require(SL_CURLY, "Expect {} to begin unless scope");
   blockTernary();
-  int elseJump = emitJump(OP_JUMP);
-  patchJump(thenJump);
-
-  emitByte(OP_POP); // end
 
   if (tokenIs(K_ELSE)) {
       errorAt(&errorMarker, "Unless block cannot branch with else. Please remove else keyword from block.");
   }
 
-  patchJump(elseJump);
+  patchJumps(&skip);
   endScope();
   require(SR_CURLY, "Expect } to end Unless scope");
 }
 
 static void ifStatement(OpCode condition) {
   advance();
-  resolveExpression(LVL_BASE);
+  JumpList elseJumps;
+  initJumpList(&elseJumps);
+  jumpCondition(condition == OP_JUMP_IF_TRUE, &elseJumps);
   Token errorMarker = currentToken();
   require(SL_CURLY, "Expect a '?' after BOOLEAN test condition.");
   beginScope();
-  int thenJump = emitJump(condition);
 
-  emitByte(OP_POP); // then
   // require(SL_CURLY, "Expect {} to begin unless scope");
   blockTernary();
-  int elseJump = emitJump(OP_JUMP);
-  patchJump(thenJump);
-
-  emitByte(OP_POP); // end
+  int endJump = tokenIs(K_ELSE) ? emitJump(OP_JUMP) : -1;
+  patchJumps(&elseJumps);
 
   if (consume(K_ELSE)) {
     Token marker = secondToken();
@@ -720,32 +1426,124 @@ static void ifStatement(OpCode condition) {
     }
     consume(SR_CURLY);
   }
-  patchJump(elseJump);
+  if (endJump != -1) patchJump(endJump);
   endScope();
 }
 
+// the key of an 'is = constant' arm, false for anything that isn't a number, text or truth
+static bool armKey(Token* token, Value* key) {
+  switch (token->lexeme) {
+    case L_NUMBER: *key = numberValue(token); return true;
+    case L_STRING: *key = copyText(token->start + 1, token->length - 2); return true;
+    case K_TRUE:   *key = BOOL_VAL(true); return true;
+    case K_FALSE:  *key = BOOL_VAL(false); return true;
+    default:       return false;
+  }
+}
+
+// whole number keys close together are looked up in an array from the lowest one on
+static void closeSwitch(int table, int missJump) {
+  patchJump(missJump);
+  Value* constant = &currentChunk()->constantPool.values[table];
+  ObjMap* targets = AS_MAP(*constant);
+  int32_t low = INT32_MAX;
+  int32_t high = INT32_MIN;
+  for (int i = 0; i < targets->used; i++) {
+    Value key = targets->entries[i].key;
+    if (!IS_INTEGER(key)) return;
+    if (AS_INTEGER(key) < low) low = AS_INTEGER(key);
+    if (AS_INTEGER(key) > high) high = AS_INTEGER(key);
+  }
+  if ((int64_t)high - low >= targets->count * 2 + DENSE_SLACK) return;
+
+  int span = high - low + 1;
+  ObjArray* dense = newArray(span + 1);
+  dense->items.values[0] = INTEGER_VAL(low);
+  for (int i = 1; i <= span; i++) {
+    dense->items.values[i] = NIL_VAL; // a gap falls through to the miss jump
+  }
+  for (int i = 0; i < targets->used; i++) {
+    dense->items.values[1 + AS_INTEGER(targets->entries[i].key) - low] = targets->entries[i].value;
+  }
+  dense->items.count = span + 1;
+  *constant = OBJ_VAL(dense);
+}
+
+/*
+  The subject is evaluated once into a hidden local. A run of 'is = constant'
+  arms becomes one OP_SWITCH on a table of where each body starts, any other
+  arm tests the subject in turn. Every body ends jumping past the rest.
+*/
 static void whenStatement() {
   advance();
-  Token token = currentToken(); // hold the value to evaluate all expressions
-  advance();
-  require(SL_CURLY, "Expect '{' to start a when block. ('when' expression '{}')");
+  Token name = secondToken(); // 'when' can't be written as a variable, so nothing else finds the local
   beginScope();
+  resolveExpression(LVL_BASE);
+  addLocal(name);
+  markInitialized();
+  uint8_t subject = (uint8_t)(current->localCount - 1);
+  require(SL_CURLY, "Expect '{' to start a when block. ('when' expression '{}')");
+  Quittable quittable;
+  beginQuittable(&quittable);
+
+  int table = -1; // the open OP_SWITCH's targets constant, -1 between runs
+  int missJump = 0;
 
   while (tokenIs(K_IS)) {
-    setCurrent(token);
-    resolveExpression(LVL_BASE);
+    advance();
+    Value key = NIL_VAL;
+    bool equals = consume(S_EQUAL);
+    Token operand = currentToken();
+    bool constant = equals && armKey(&operand, &key);
+    if (constant) advance();
+
+    int testJump = -1;
+    if (constant && tokenIs(SL_CURLY)) {
+      if (table == -1) {
+        emitBytes(OP_GET_LOCAL, subject);
+        table = makeConstant(OBJ_VAL(newMap()));
+        emitBytes(OP_SWITCH, (uint8_t)table);
+        emitBytes(0xff, 0xff); // patched like any jump once the run ends
+        missJump = currentChunk()->count - 2;
+      }
+      ObjMap* targets = AS_MAP(currentChunk()->constantPool.values[table]);
+      Value unused;
+      if (!mapGet(targets, key, &unused)) { // the first arm for a key is the one that runs
+        mapSet(targets, key, INTEGER_VAL(currentChunk()->count));
+      }
+    } else {
+      if (table != -1) {
+        closeSwitch(table, missJump);
+        table = -1;
+      }
+      emitBytes(OP_GET_LOCAL, subject);
+      if (constant) { // the literal was only the start of the operand
+        resolvePrefix(false);
+        continueExpression(LVL_EQUAL + 1);
+        emitByte(OP_EQUAL);
+        setComparison(S_EQUAL);
+      } else if (equals) {
+        resolveExpression(LVL_EQUAL + 1);
+        emitByte(OP_EQUAL);
+        setComparison(S_EQUAL);
+      }
+      continueExpression(LVL_BASE);
+      testJump = emitConditionJump(false);
+    }
     require(SL_CURLY, "Expect 'is' comparator operand '{' to test condition.");
 
-    int thenJump = emitJump(OP_JUMP_IF_FALSE);
-
+    beginScope();
     while (tokenIsNot(SR_CURLY) && tokenIsNot(END_OF_FILE))
     { compileTokens(); }
+    endScope();
 
-    emitByte(OP_QUIT);
+    addJump(&quittable.exits, emitJump(OP_JUMP));
     require(SR_CURLY, "Expect } to complete an 'is' block to finish a 'when' statement.");
-    patchJump(thenJump);
+    if (testJump != -1) patchJump(testJump);
   }
-  emitByte(OP_QUIT_END); // TODO only statement that has this, might add to while and until, add 'quit' keyword
+  if (table != -1) closeSwitch(table, missJump);
+
+  endQuittable();
   endScope();
   require(SR_CURLY, "Expect } to complete a when block.");
 }
@@ -760,6 +1558,69 @@ static void scopeVariable() {
   defineConstant(global);
 }
 
+/*
+  while, #i : 0; is < n { ...; #i += 1 } steps and tests its counter in one
+  OP_FOR_STEP at the bottom, the condition up top only runs the first time.
+  The limit has to be a single read, it is copied down to just before the step.
+*/
+static bool forStep(int loopStart, int conditionEnd, int bodyStart, int lastStatement) {
+  Chunk* chunk = currentChunk();
+  uint8_t* test = chunk->code + loopStart;
+  if (conditionEnd - loopStart != 7) return false;
+  if (test[0] != OP_GET_LOCAL) return false;
+  uint8_t slot = test[1];
+  uint8_t limit = test[2];
+  uint8_t limitArg = test[3];
+  if (limit != OP_CONSTANT && limit != OP_GET_LOCAL
+      && limit != OP_GET_GLOBAL && limit != OP_GET_UPVALUE) return false;
+  if (limit == OP_GET_LOCAL && limitArg == slot) return false; // it would be read before the step
+
+  // the loop goes on while the exit jump isn't taken
+  uint8_t compare;
+  bool expect;
+  switch (test[4]) {
+    case OP_JUMP_IF_NOT_LESS:    compare = OP_LESS;    expect = true;  break;
+    case OP_JUMP_IF_LESS:        compare = OP_LESS;    expect = false; break;
+    case OP_JUMP_IF_NOT_GREATER: compare = OP_GREATER; expect = true;  break;
+    case OP_JUMP_IF_GREATER:     compare = OP_GREATER; expect = false; break;
+    default: return false;
+  }
+
+  // #i += k, #i := #i + k or #i := #i - k as the last statement
+  uint8_t* step = chunk->code + lastStatement;
+  int stepLength = chunk->count - lastStatement;
+  uint8_t amount;
+  bool subtract = false;
+  if (lastStatement < bodyStart) return false;
+  if (stepLength == 3 && step[0] == OP_ADD_LOCAL_CONSTANT && step[1] == slot) {
+    amount = step[2];
+  } else if (stepLength == 8 && step[0] == OP_GET_LOCAL && step[1] == slot
+      && step[2] == OP_CONSTANT && (step[4] == OP_ADD || step[4] == OP_SUBTRACT)
+      && step[5] == OP_SET_LOCAL && step[6] == slot && step[7] == OP_POP) {
+    amount = step[3];
+    subtract = step[4] == OP_SUBTRACT;
+  } else {
+    return false;
+  }
+  Value value = chunk->constantPool.values[amount];
+  if (!IS_NUMBER(value)) return false;
+  if (subtract) {
+    amount = makeConstant(IS_INTEGER(value) && AS_INTEGER(value) != INT32_MIN
+        ? INTEGER_VAL(-AS_INTEGER(value)) : NUMBER_VAL(-AS_NUMBER(value)));
+  }
+
+  chunk->count = lastStatement; // the step itself goes into OP_FOR_STEP
+  emitBytes(limit, limitArg);
+  emitBytes(OP_FOR_STEP, slot);
+  emitBytes(amount, compare);
+  emitByte(expect);
+
+  int offset = chunk->count - bodyStart + 2;
+  if (offset > UINT16_MAX) error("Loop body too large.");
+  emitBytes((offset >> 8) & 0xff, offset & 0xff);
+  return true;
+}
+
 static void loopWithCondition(OpCode condition) {
   advance();
   beginScope();
@@ -779,19 +1640,24 @@ static void loopWithCondition(OpCode condition) {
     loopStart = currentChunk()->count;
   } // nice to have for two pointer technique
 
-  resolveExpression(LVL_BASE);
+  JumpList exits;
+  initJumpList(&exits);
+  jumpCondition(condition == OP_JUMP_IF_TRUE, &exits); // leaves on false for while, true for until
+  int conditionEnd = currentChunk()->count;
   require(SL_CURLY, "Expect '{' after condition, to begin conditional loop.");
   Token marker = secondToken();
+  Quittable quittable;
+  beginQuittable(&quittable);
 
-  int exitJump = emitJump(condition); // false for while, true for until
-  emitByte(OP_POP);
+  int bodyStart = currentChunk()->count;
   // require(SL_CURLY, "Expect {} to enclose loop scope");
-  block(&marker);
-  emitLoop(loopStart);
+  int lastStatement = block(&marker);
+  if (!forStep(loopStart, conditionEnd, bodyStart, lastStatement)) {
+    emitLoop(loopStart);
+  }
 
-  patchJump(exitJump);
-  emitByte(OP_POP);
-  emitByte(OP_QUIT_END);
+  patchJumps(&exits);
+  endQuittable();
   endScope();
 }
 
@@ -813,14 +1679,109 @@ static void compileTokens() {
       if (secondToken().lexeme != SR_CURLY) {  // TODO maybe write optionals for ')', '}', ']'
         require(S_SEMICOLON, "Expect ';' after expression.");
       }
-      emitByte(OP_POP); // get the value
+      if (reloadChunk == currentChunk() && reloadEnd == currentChunk()->count) {
+        currentChunk()->count -= 2; // nothing wants the assigned value
+      } else {
+        emitByte(OP_POP); // get the value
+      }
     }
   }
   if (panic()) synchronize();
 }
 
+/*
+  Everything compile() allocates lives in vm.compilerArena, out of the
+  collector's sight, so no collection can run mid-compile. Once the script
+  is finished its function graph is copied into the heap (or the request
+  arena, under a checkpoint) in one pass.
+*/
+static ObjString* promoteString(ObjString* string) {
+  return copyString(string->chars, string->length); // finds or interns the heap copy
+}
+
+// a when's switch table, its keys are the only objects in it
+static Value promoteTable(Value table) {
+  if (IS_ARRAY(table)) {
+    ValueArray* from = &AS_ARRAY(table)->items;
+    ObjArray* array = newArray(from->count);
+    memcpy(array->items.values, from->values, sizeof(Value) * from->count);
+    array->items.count = from->count;
+    return OBJ_VAL(array);
+  }
+  ObjMap* from = AS_MAP(table);
+  ObjMap* map = newMap();
+  push(OBJ_VAL(map));
+  reserveMap(map, from->count); // so no key is left unrooted by a growing map
+  for (int i = 0; i < from->used; i++) {
+    Value key = from->entries[i].key;
+    if (IS_STRING(key)) key = OBJ_VAL(promoteString(AS_STRING(key)));
+    mapSet(map, key, from->entries[i].value);
+  }
+  pop();
+  return OBJ_VAL(map);
+}
+
+static ObjFunction* promoteFunction(ObjFunction* compiled) {
+  ObjFunction* function = newFunction();
+  push(OBJ_VAL(function)); // rooted while its constants are promoted
+  function->arity = compiled->arity;
+  function->upvalueCount = compiled->upvalueCount;
+  if (compiled->name != NULL) function->name = promoteString(compiled->name);
+
+  Chunk* from = &compiled->chunk;
+  Chunk* to = &function->chunk;
+  to->code = ALLOCATE(uint8_t, from->count);
+  to->lines = ALLOCATE(int, from->count);
+  to->capacity = from->count;
+  to->count = from->count;
+  memcpy(to->code, from->code, from->count);
+  memcpy(to->lines, from->lines, sizeof(int) * from->count);
+
+  ValueArray* pool = &to->constantPool;
+  pool->values = ALLOCATE(Value, from->constantPool.count);
+  pool->capacity = from->constantPool.count;
+  for (int i = 0; i < from->constantPool.count; i++) {
+    Value constant = from->constantPool.values[i];
+    if (IS_STRING(constant)) {
+      constant = OBJ_VAL(promoteString(AS_STRING(constant)));
+    } else if (IS_FUNCTION(constant)) {
+      constant = OBJ_VAL(promoteFunction(AS_FUNCTION(constant)));
+    } else if (IS_MAP(constant) || IS_ARRAY(constant)) {
+      constant = promoteTable(constant);
+    }
+    pool->values[pool->count++] = constant;
+  }
+
+  to->caches = ALLOCATE(PropertyCache, from->cacheCount);
+  to->cacheCount = from->cacheCount;
+  if (from->cacheCount > 0) { // still empty, nothing has run yet
+    memcpy(to->caches, from->caches, sizeof(PropertyCache) * from->cacheCount);
+  }
+  to->callCaches = ALLOCATE(CallCache, from->callCacheCount);
+  to->callCacheCount = from->callCacheCount;
+  if (from->callCacheCount > 0) {
+    memcpy(to->callCaches, from->callCaches, sizeof(CallCache) * from->callCacheCount);
+  }
+
+  pop();
+  return function;
+}
+
 ObjFunction* compile(const char* source) {
   initScanner(source);
+  current = NULL; // a previous compile may have been unwound by an out of memory error
+  Arena* heap = vm.arena; // the request arena when running under a checkpoint
+  vm.arena = &vm.compilerArena;
+
+  layouts = NULL;
+  layoutCount = 0;
+  typedGlobals = NULL;
+  typedGlobalCount = 0;
+  typedChunk = NULL;
+  knownChunk = NULL;
+  comparisonChunk = NULL;
+  reloadChunk = NULL;
+  calleeChunk = NULL;
 
   Compiler compiler;
   initCompiler(&compiler, FT_SCRIPT);
@@ -833,13 +1794,9 @@ ObjFunction* compile(const char* source) {
   }
 
   ObjFunction* function = endCompiler(); // it all ends as one script function
+  vm.arena = heap;
+
+  if (!hasError()) function = promoteFunction(function);
+  freeArena(&vm.compilerArena);
   return hasError() ? NULL : function;
 }
-// Garbage Collection
-void markCompilerRoots() {
-  Compiler* compiler = current;
-  while (compiler != NULL) {
-    markObject((Obj*)compiler->function);
-    compiler = compiler->enclosing;
-  }
-}
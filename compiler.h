@@ -6,17 +6,59 @@
 #include "scanner.h"
 #include "table.h"
 
+// a structure's fields as declared, known while compiling
+typedef struct {
+  Token* fields;
+  int fieldCount;
+} Layout;
+
+// what the compiler knows about a value, layouts are indexes, -1 when unknown
+typedef struct {
+  int declares; // the structure itself, as Point: use { x, y }
+  int holds;    // an instance of it, as p: Point(1, 2)
+} StaticType;
+
 typedef struct {
   Token name;
   int depth;
   bool isCaptured; // Closures is-captured-field
+  StaticType type;
 } Local;
 
+typedef struct {
+  Token name;
+  StaticType type;
+  bool isKnown; // an immutable global set to a constant, its uses compile to the constant
+  Value value;
+  ObjFunction* inlined; // a small pure immutable function, its calls compile to its body
+} TypedGlobal;
+
+typedef struct {
+  ObjFunction* function;
+  int start;
+  int end;
+  int pool;
+} Callee;
+
 typedef struct {
   uint8_t index;
   bool isLocal;
 } Upvalue; // for Closures
 
+// forward jumps that all land in the same place, patched once it is known
+typedef struct {
+  int* offsets;
+  int count;
+  int capacity;
+} JumpList;
+
+// a loop or when block that 'quit' can leave
+typedef struct Quittable {
+  struct Quittable* enclosing;
+  int scopeDepth; // locals deeper than this are popped on the way out
+  JumpList exits;
+} Quittable;
+
 typedef enum {
   FT_FUNCTION,
   FT_INITIALIZER, // for objects initializer-type-enum
@@ -32,7 +74,7 @@ typedef struct Compiler {
   int localCount;
   Upvalue upvalues[UINT8_COUNT]; // Closures upvalues array
   int scopeDepth;
-  Table identifierTypes;
+  Quittable* quittable; // the innermost one in this function, NULL outside of any
 } Compiler;
 
 typedef struct ClassCompiler {
@@ -40,7 +82,6 @@ typedef struct ClassCompiler {
 } ClassCompiler;
 
 ObjFunction* compile(const char* source); // Calls and Functions compile-h
-void markCompilerRoots(); // Garbage Collection mark-compiler-roots-h
 
 #endif
 
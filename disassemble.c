@@ -21,15 +21,41 @@ static int constantInstruction(const char* name, Chunk* chunk, int offset) {
   return offset + 2;
 }
 
-static int invokeInstruction(const char* name, Chunk* chunk, int offset) {
+static int propertyInstruction(const char* name, Chunk* chunk, int offset) {
   uint8_t constant = chunk->code[offset + 1];
-  uint8_t argCount = chunk->code[offset + 2];
-  printf("%-16s (%d args) %4d '", name, argCount, constant);
+  uint16_t cache = (uint16_t)((chunk->code[offset + 2] << 8) | chunk->code[offset + 3]);
+  printf("%-16s %4d '", name, constant);
+  printValue(chunk->constantPool.values[constant]);
+  printf("' cache %d\n", cache);
+  return offset + 4;
+}
+
+static int fieldInstruction(const char* name, Chunk* chunk, int offset) {
+  uint8_t slot = chunk->code[offset + 1];
+  uint8_t constant = chunk->code[offset + 2];
+  printf("%-16s %4d '", name, slot);
   printValue(chunk->constantPool.values[constant]);
   printf("'\n");
   return offset + 3;
 }
 
+static int invokeInstruction(const char* name, Chunk* chunk, int offset) {
+  uint8_t constant = chunk->code[offset + 1];
+  uint16_t cache = (uint16_t)((chunk->code[offset + 2] << 8) | chunk->code[offset + 3]);
+  uint8_t argCount = chunk->code[offset + 4];
+  printf("%-16s (%d args) %4d '", name, argCount, constant);
+  printValue(chunk->constantPool.values[constant]);
+  printf("' cache %d\n", cache);
+  return offset + 5;
+}
+
+static int callInstruction(const char* name, Chunk* chunk, int offset) {
+  uint8_t argCount = chunk->code[offset + 1];
+  uint16_t cache = (uint16_t)((chunk->code[offset + 2] << 8) | chunk->code[offset + 3]);
+  printf("%-16s %4d cache %d\n", name, argCount, cache);
+  return offset + 4;
+}
+
 static int simpleInstruction(const char* name, int offset) {
   printf("%s\n", name);
   return offset + 1;
@@ -48,6 +74,27 @@ static int jumpInstruction(const char* name, int sign, Chunk* chunk, int offset)
   return offset + 3;
 }
 
+static int forStepInstruction(const char* name, Chunk* chunk, int offset) {
+  uint8_t slot = chunk->code[offset + 1];
+  uint8_t constant = chunk->code[offset + 2];
+  bool less = chunk->code[offset + 3] == OP_LESS;
+  bool expect = chunk->code[offset + 4];
+  uint16_t jump = (uint16_t)((chunk->code[offset + 5] << 8) | chunk->code[offset + 6]);
+  printf("%-16s %4d += '", name, slot);
+  printValue(chunk->constantPool.values[constant]);
+  printf("' %s%c -> %d\n", expect ? "" : "!", less ? '<' : '>', offset + 7 - jump);
+  return offset + 7;
+}
+
+static int switchInstruction(const char* name, Chunk* chunk, int offset) {
+  uint8_t constant = chunk->code[offset + 1];
+  uint16_t jump = (uint16_t)((chunk->code[offset + 2] << 8) | chunk->code[offset + 3]);
+  printf("%-16s %4d '", name, constant);
+  printValue(chunk->constantPool.values[constant]);
+  printf("' else -> %d\n", offset + 4 + jump);
+  return offset + 4;
+}
+
 int disassembleInstruction(Chunk* chunk, int offset) {
   printf("%04d ", offset);
   //> show-location
@@ -63,6 +110,36 @@ int disassembleInstruction(Chunk* chunk, int offset) {
   switch (instruction) {
     case OP_CONSTANT:
       return constantInstruction("OP_CONSTANT", chunk, offset);
+    case OP_CLASS: {
+      uint8_t fieldCount = chunk->code[offset + 2];
+      printf("%-16s %4d '", "OP_CLASS", chunk->code[offset + 1]);
+      printValue(chunk->constantPool.values[chunk->code[offset + 1]]);
+      printf("' {");
+      for (int i = 0; i < fieldCount; i++) {
+        printf(i == 0 ? " " : ", ");
+        printValue(chunk->constantPool.values[chunk->code[offset + 3 + i]]);
+      }
+      printf(" }\n");
+      return offset + 3 + fieldCount;
+    }
+    case OP_GET_FIELD:
+      return fieldInstruction("OP_GET_FIELD", chunk, offset);
+    case OP_SET_FIELD:
+      return fieldInstruction("OP_SET_FIELD", chunk, offset);
+    case OP_GET_PROPERTY:
+      return propertyInstruction("OP_GET_PROPERTY", chunk, offset);
+    case OP_SET_PROPERTY:
+      return propertyInstruction("OP_SET_PROPERTY", chunk, offset);
+    case OP_ARRAY:
+      return byteInstruction("OP_ARRAY", chunk, offset);
+    case OP_GET_INDEX:
+      return simpleInstruction("OP_GET_INDEX", offset);
+    case OP_SET_INDEX:
+      return simpleInstruction("OP_SET_INDEX", offset);
+    case OP_LENGTH:
+      return simpleInstruction("OP_LENGTH", offset);
+    case OP_MAP:
+      return byteInstruction("OP_MAP", chunk, offset);
     case OP_NIL:
       return simpleInstruction("OP_NIL", offset);
     case OP_TRUE:
@@ -75,6 +152,18 @@ int disassembleInstruction(Chunk* chunk, int offset) {
       return byteInstruction("OP_GET_LOCAL", chunk, offset);
     case OP_SET_LOCAL:
       return byteInstruction("OP_SET_LOCAL", chunk, offset);
+    case OP_ADD_LOCAL:
+      return byteInstruction("OP_ADD_LOCAL", chunk, offset);
+    case OP_ADD_LOCAL_CONSTANT:
+      return fieldInstruction("OP_ADD_LOCAL_CONSTANT", chunk, offset);
+    case OP_MULTIPLY_LOCAL:
+      return byteInstruction("OP_MULTIPLY_LOCAL", chunk, offset);
+    case OP_MULTIPLY_LOCAL_CONSTANT:
+      return fieldInstruction("OP_MULTIPLY_LOCAL_CONSTANT", chunk, offset);
+    case OP_CONCATENATE_LOCAL:
+      return byteInstruction("OP_CONCATENATE_LOCAL", chunk, offset);
+    case OP_CONCATENATE_LOCAL_CONSTANT:
+      return fieldInstruction("OP_CONCATENATE_LOCAL_CONSTANT", chunk, offset);
     case OP_GET_GLOBAL:
       return constantInstruction("OP_GET_GLOBAL", chunk, offset);
     case OP_DEFINE_GLOBAL:
@@ -99,6 +188,10 @@ int disassembleInstruction(Chunk* chunk, int offset) {
       return simpleInstruction("OP_MULTIPLY", offset);
     case OP_DIVIDE:
       return simpleInstruction("OP_DIVIDE", offset);
+    case OP_CONCATENATE:
+      return simpleInstruction("OP_CONCATENATE", offset);
+    case OP_CONCATENATE_N:
+      return byteInstruction("OP_CONCATENATE_N", chunk, offset);
     case OP_NOT:
       return simpleInstruction("OP_NOT", offset);
     case OP_NEGATE:
@@ -111,10 +204,30 @@ int disassembleInstruction(Chunk* chunk, int offset) {
       return jumpInstruction("OP_JUMP_IF_TRUE", 1, chunk, offset);
     case OP_JUMP_IF_FALSE:
       return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+    case OP_POP_JUMP_IF_FALSE:
+      return jumpInstruction("OP_POP_JUMP_IF_FALSE", 1, chunk, offset);
+    case OP_POP_JUMP_IF_TRUE:
+      return jumpInstruction("OP_POP_JUMP_IF_TRUE", 1, chunk, offset);
+    case OP_JUMP_IF_LESS:
+      return jumpInstruction("OP_JUMP_IF_LESS", 1, chunk, offset);
+    case OP_JUMP_IF_NOT_LESS:
+      return jumpInstruction("OP_JUMP_IF_NOT_LESS", 1, chunk, offset);
+    case OP_JUMP_IF_GREATER:
+      return jumpInstruction("OP_JUMP_IF_GREATER", 1, chunk, offset);
+    case OP_JUMP_IF_NOT_GREATER:
+      return jumpInstruction("OP_JUMP_IF_NOT_GREATER", 1, chunk, offset);
+    case OP_JUMP_IF_EQUAL:
+      return jumpInstruction("OP_JUMP_IF_EQUAL", 1, chunk, offset);
+    case OP_JUMP_IF_NOT_EQUAL:
+      return jumpInstruction("OP_JUMP_IF_NOT_EQUAL", 1, chunk, offset);
     case OP_LOOP:
       return jumpInstruction("OP_LOOP", -1, chunk, offset);
+    case OP_FOR_STEP:
+      return forStepInstruction("OP_FOR_STEP", chunk, offset);
+    case OP_SWITCH:
+      return switchInstruction("OP_SWITCH", chunk, offset);
     case OP_CALL:
-      return byteInstruction("OP_CALL", chunk, offset);
+      return callInstruction("OP_CALL", chunk, offset);
     case OP_INVOKE:
       return invokeInstruction("OP_INVOKE", chunk, offset);
     case OP_CLOSURE: {
@@ -0,0 +1,133 @@
+#include <stdio.h>
+
+#include "map.h"
+#include "memory.h"
+
+#define MAP_EMPTY   -1
+#define MAP_REMOVED -2 // its entry was removed, still part of probe chains
+// the index is at most 2/3 full, the entries array holds that many
+#define ENTRIES_FOR(indexCapacity) ((indexCapacity) / 3 * 2)
+
+void initMap(ObjMap* map) {
+  map->count = 0;
+  map->used = 0;
+  map->capacity = 0;
+  map->indexCapacity = 0;
+  map->index = NULL;
+  map->entries = NULL;
+}
+
+void freeMap(ObjMap* map) {
+  FREE_ARRAY(int32_t, map->index, map->indexCapacity);
+  FREE_ARRAY(MapEntry, map->entries, map->capacity);
+  initMap(map);
+}
+
+// the slot of key's position in the index, or the empty slot it would take
+static int findSlot(ObjMap* map, Value key, uint32_t hash) {
+  uint32_t mask = (uint32_t)map->indexCapacity - 1;
+  for (uint32_t slot = hash & mask; ; slot = (slot + 1) & mask) {
+    int32_t position = map->index[slot];
+    if (position == MAP_EMPTY) return (int)slot;
+    if (position >= 0 && map->entries[position].hash == hash
+        && valuesEqual(map->entries[position].key, key)) {
+      return (int)slot;
+    }
+  }
+}
+
+// room for at least needed entries, the removed ones are squeezed out on the way
+static void rebuild(ObjMap* map, int needed) {
+  int indexCapacity = 8;
+  while (ENTRIES_FOR(indexCapacity) < needed) indexCapacity *= 2;
+  int capacity = ENTRIES_FOR(indexCapacity);
+  MapEntry* entries = ALLOCATE(MapEntry, capacity);
+  int32_t* index = ALLOCATE(int32_t, indexCapacity);
+  for (int i = 0; i < indexCapacity; i++) {
+    index[i] = MAP_EMPTY;
+  }
+
+  uint32_t mask = (uint32_t)indexCapacity - 1;
+  int used = 0;
+  for (int i = 0; i < map->used; i++) {
+    MapEntry* entry = &map->entries[i];
+    if (IS_NIL(entry->key)) continue;
+    uint32_t slot = entry->hash & mask;
+    while (index[slot] != MAP_EMPTY) slot = (slot + 1) & mask;
+    index[slot] = used;
+    entries[used++] = *entry;
+  }
+
+  FREE_ARRAY(int32_t, map->index, map->indexCapacity);
+  FREE_ARRAY(MapEntry, map->entries, map->capacity);
+  map->index = index;
+  map->entries = entries;
+  map->indexCapacity = indexCapacity;
+  map->capacity = capacity;
+  map->used = used;
+}
+
+// sized up front, so a literal is laid out without growing
+void reserveMap(ObjMap* map, int count) {
+  if (map->capacity < count) rebuild(map, count);
+}
+
+bool mapGet(ObjMap* map, Value key, Value* value) {
+  if (map->count == 0) return false;
+  int32_t position = map->index[findSlot(map, key, hashValue(key))];
+  if (position < 0) return false;
+  *value = map->entries[position].value;
+  return true;
+}
+
+// the map, key and value must be reachable, growing can collect
+void mapSet(ObjMap* map, Value key, Value value) {
+  uint32_t hash = hashValue(key);
+  if (map->count > 0) {
+    int32_t position = map->index[findSlot(map, key, hash)];
+    if (position >= 0) {
+      map->entries[position].value = value;
+      return;
+    }
+  }
+  if (map->used == map->capacity) rebuild(map, (map->count + 1) * 2);
+
+  int slot = findSlot(map, key, hash);
+  map->index[slot] = map->used;
+  map->entries[map->used++] = (MapEntry){key, value, hash};
+  map->count++;
+}
+
+bool mapRemove(ObjMap* map, Value key) {
+  if (map->count == 0) return false;
+  int slot = findSlot(map, key, hashValue(key));
+  int32_t position = map->index[slot];
+  if (position < 0) return false;
+  map->index[slot] = MAP_REMOVED;
+  map->entries[position].key = NIL_VAL;
+  map->entries[position].value = NIL_VAL;
+  map->count--;
+  return true;
+}
+
+void markMap(ObjMap* map) {
+  for (int i = 0; i < map->used; i++) {
+    markValue(map->entries[i].key);
+    markValue(map->entries[i].value);
+  }
+}
+
+void printMap(ObjMap* map) {
+  bool first = true;
+  printf("{");
+  for (int i = 0; i < map->used; i++) {
+    MapEntry* entry = &map->entries[i];
+    if (IS_NIL(entry->key)) continue;
+    printf(first ? "" : ", ");
+    first = false;
+    printValue(entry->key);
+    printf(": ");
+    printValue(entry->value);
+  }
+  printf("}");
+}
@@ -0,0 +1,20 @@
+#ifndef mu_map_h
+#define mu_map_h
+
+#include "object.h"
+
+/*
+  { key: value }, any Value but null as a key. The entries are kept dense
+  in the order their keys were first added, a separate index of
+  positions into them is what gets probed.
+*/
+void initMap(ObjMap* map);
+void freeMap(ObjMap* map);
+void reserveMap(ObjMap* map, int count);
+bool mapGet(ObjMap* map, Value key, Value* value);
+void mapSet(ObjMap* map, Value key, Value value);
+bool mapRemove(ObjMap* map, Value key);
+void markMap(ObjMap* map);
+void printMap(ObjMap* map);
+
+#endif
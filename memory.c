@@ -1,39 +1,72 @@
+#include <stdio.h>
 #include <stdlib.h>
-#include "compiler.h" // Garbage Collection memory-include-compiler
+#include "map.h"
 #include "memory.h"
 #include "vm.h" // Strings memory-include-vm
 
 // Garbage Collection debug-log-includes
 #ifdef DEBUG_LOG_GC
-#include <stdio.h>
 #include "debug.h"
 #endif
 
-#define GC_HEAP_GROW_FACTOR 2 // Garbage Collection heap-grow-factor
-
 // responsible for freeing objects in memory
 
+/*
+  Out of memory, either the heap limit was reached or realloc failed.
+  Unwinds to interpret() when a script is running so the host gets a
+  runtime error back instead of losing the whole process.
+*/
+static void outOfMemory() {
+  if (vm.memoryError != NULL) {
+    longjmp(*vm.memoryError, 1);
+  }
+  fprintf(stderr, "Out of memory.\n");
+  exit(1);
+}
+
+static bool overHeapLimit(size_t growth) {
+  return vm.gcConfig.heapLimit != 0
+      && vm.bytesAllocated + growth > vm.gcConfig.heapLimit;
+}
+
+// arena memory is never collected, so it cannot trigger a collection either
+static void* reallocateInArena(void* pointer, size_t oldSize, size_t newSize) {
+  if (newSize > oldSize && overHeapLimit(vm.arena->bytes + newSize - oldSize)) {
+    outOfMemory();
+  }
+  void* result = arenaReallocate(vm.arena, pointer, oldSize, newSize);
+  if (result == NULL && newSize != 0) outOfMemory();
+  return result;
+}
+
 void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
-  vm.bytesAllocated += newSize - oldSize; // updated bytes allocated
+  if (vm.arena != NULL) return reallocateInArena(pointer, oldSize, newSize);
 
   if (newSize > oldSize) {
+    size_t growth = newSize - oldSize;
 #ifdef DEBUG_STRESS_GC
     collectGarbage();
 #endif
-    if (vm.bytesAllocated > vm.nextGC) {
+    if (vm.bytesAllocated + growth > vm.nextGC) {
       collectGarbage(); // collect-on-next
     }
+    if (overHeapLimit(growth)) {
+      collectGarbage(); // one full collection before giving up
+      if (overHeapLimit(growth)) outOfMemory();
+    }
   }
 
   if (newSize == 0) {
+    vm.bytesAllocated -= oldSize;
     free(pointer);
     return NULL;
   }
   void* result = realloc(pointer, newSize);
 // out of memory
   if (result == NULL) {
-    exit(1); 
-  } 
+    outOfMemory();
+  }
+  vm.bytesAllocated += newSize - oldSize; // updated bytes allocated
   return result;
 }
 
@@ -80,9 +113,15 @@ static void blackenObject(Obj* object) {
 //^ log-blacken-object
 
   switch (object->type) {
+    case OBJ_ARRAY:
+      markArray(&((ObjArray*)object)->items);
+      break;
     case OBJ_CLASS: {
       ObjClass* definition = (ObjClass*)object;
-      markObject((Obj*)definition->name);
+      markValue(definition->name);
+      for (int i = 0; i < definition->fieldCount; i++) {
+        markValue(definition->fields[i]);
+      }
       break;
     }
     case OBJ_CLOSURE: {
@@ -97,6 +136,54 @@ static void blackenObject(Obj* object) {
       ObjFunction* function = (ObjFunction*)object;
       markObject((Obj*)function->name);
       markArray(&function->chunk.constantPool);
+      // a cached structure must not be freed and its address reused
+      for (int i = 0; i < function->chunk.cacheCount; i++) {
+        for (int way = 0; way < CACHE_WAYS; way++) {
+          markObject((Obj*)function->chunk.caches[i].definitions[way]);
+        }
+      }
+      for (int i = 0; i < function->chunk.callCacheCount; i++) {
+        markObject(function->chunk.callCaches[i].callee);
+      }
+      break;
+    }
+    case OBJ_INSTANCE: {
+      ObjInstance* instance = (ObjInstance*)object;
+      markObject((Obj*)instance->definition);
+      for (int i = 0; i < instance->fieldCount; i++) {
+        markValue(instance->fields[i]);
+      }
+      break;
+    }
+    case OBJ_ROPE: {
+      ObjRope* rope = (ObjRope*)object;
+      markValue(rope->left);
+      markValue(rope->right);
+      markObject((Obj*)rope->flat);
+      break;
+    }
+    case OBJ_SLICE: {
+      ObjSlice* slice = (ObjSlice*)object;
+      markObject((Obj*)slice->parent);
+      break;
+    }
+    case OBJ_LIST: {
+      ObjList* list = (ObjList*)object;
+      markObject((Obj*)list->root);
+      markObject((Obj*)list->tail);
+      break;
+    }
+    case OBJ_MAP:
+      markMap((ObjMap*)object);
+      break;
+    case OBJ_TRIE_MAP:
+      markObject((Obj*)((ObjTrieMap*)object)->root);
+      break;
+    case OBJ_TRIE_NODE: {
+      ObjTrieNode* node = (ObjTrieNode*)object;
+      for (int i = 0; i < node->size; i++) {
+        markValue(node->slots[i]);
+      }
       break;
     }
     case OBJ_UPVALUE:
@@ -104,6 +191,7 @@ static void blackenObject(Obj* object) {
       break;
     case OBJ_NATIVE:
     case OBJ_STRING:
+    case OBJ_VECTOR:
       break;
   }
 }
@@ -116,15 +204,20 @@ static void freeObject(Obj* object) {
 //^ Garbage Collection log-free-object
 
   switch (object->type) {
+    case OBJ_ARRAY:
+      freeValueArray(&((ObjArray*)object)->items);
+      FREE(ObjArray, object);
+      break;
     case OBJ_CLASS: {
-      FREE(ObjClass, object);
+      ObjClass* definition = (ObjClass*)object;
+      reallocate(object, sizeof(ObjClass)
+          + sizeof(Value) * definition->fieldCount, 0); // field names are inline
       break;
     }
     case OBJ_CLOSURE: {
       ObjClosure* closure = (ObjClosure*)object;
-      FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalueCount);
-  //^ free-upvalues
-      FREE(ObjClosure, object);
+      reallocate(object, sizeof(ObjClosure)
+          + sizeof(ObjUpvalue*) * closure->upvalueCount, 0); // upvalues are inline
       break;
     }
     case OBJ_FUNCTION: {
@@ -133,18 +226,47 @@ static void freeObject(Obj* object) {
       FREE(ObjFunction, object);
       break;
     }
+    case OBJ_INSTANCE: {
+      ObjInstance* instance = (ObjInstance*)object;
+      reallocate(object, sizeof(ObjInstance)
+          + sizeof(Value) * instance->fieldCount, 0); // fields are inline
+      break;
+    }
     case OBJ_NATIVE:
       FREE(ObjNative, object);
       break;
+    case OBJ_ROPE:
+      FREE(ObjRope, object);
+      break;
+    case OBJ_SLICE:
+      FREE(ObjSlice, object);
+      break;
     case OBJ_STRING: {
       ObjString* string = (ObjString*)object;
-      FREE_ARRAY(char, string->chars, string->length + 1);
-      FREE(ObjString, object);
+      reallocate(object, sizeof(ObjString) + string->length + 1, 0); // chars are inline
       break;
     }
+    case OBJ_LIST:
+      FREE(ObjList, object);
+      break;
+    case OBJ_MAP:
+      freeMap((ObjMap*)object);
+      FREE(ObjMap, object);
+      break;
+    case OBJ_TRIE_MAP:
+      FREE(ObjTrieMap, object);
+      break;
+    case OBJ_TRIE_NODE:
+      reallocate(object, sizeof(ObjTrieNode)
+          + sizeof(Value) * ((ObjTrieNode*)object)->size, 0); // slots are inline
+      break;
     case OBJ_UPVALUE:
       FREE(ObjUpvalue, object);
       break;
+    case OBJ_VECTOR:
+      reallocate(object, sizeof(ObjVector)
+          + sizeof(double) * ((ObjVector*)object)->length, 0); // values are inline
+      break;
   }
 }
 //^ Strings free-object
@@ -166,8 +288,6 @@ static void markRoots() {
   
   markTable(&vm.globals); // mark-globals
 
-  markCompilerRoots();
-
   markObject((Obj*)vm.initString); // Methods and Initializers
 }
 
@@ -199,6 +319,38 @@ static void sweep() { // GC
   }
 }
 
+/*
+  Pacer, nudges the grow factor so the share of time spent collecting
+  stays near gcTimeTarget. A bigger factor means fewer collections at the
+  cost of a larger heap, so it backs off again once there is headroom.
+*/
+static void paceCollector(clock_t gcTime, clock_t mutatorTime) {
+  GCConfig* config = &vm.gcConfig;
+  if (config->gcTimeTarget <= 0) return;
+
+  double total = (double)(gcTime + mutatorTime);
+  if (total <= 0) return;
+  double share = (double)gcTime / total;
+
+  if (share > config->gcTimeTarget) {
+    vm.heapGrowFactor *= 1.5;
+  } else if (share < config->gcTimeTarget / 2) {
+    vm.heapGrowFactor *= 0.9;
+  }
+  if (vm.heapGrowFactor > config->maxGrowFactor) vm.heapGrowFactor = config->maxGrowFactor;
+  if (vm.heapGrowFactor < config->minGrowFactor) vm.heapGrowFactor = config->minGrowFactor;
+}
+
+static void updateNextGC() {
+  vm.nextGC = (size_t)((double)vm.bytesAllocated * vm.heapGrowFactor);
+  if (vm.nextGC < vm.gcConfig.initialHeap) {
+    vm.nextGC = vm.gcConfig.initialHeap;
+  }
+  if (vm.gcConfig.heapLimit != 0 && vm.nextGC > vm.gcConfig.heapLimit) {
+    vm.nextGC = vm.gcConfig.heapLimit;
+  }
+}
+
 void collectGarbage() { // GC
 #ifdef DEBUG_LOG_GC
   printf("-- gc begin\n");
@@ -207,12 +359,17 @@ void collectGarbage() { // GC
 //< log-before-size
 #endif
 //^ log-before-collect
+  clock_t start = clock();
 
   markRoots();
   traceReferences();
   tableRemoveWhite(&vm.strings); // sweep-strings
   sweep();
-  vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR; // update-next-gc
+
+  clock_t end = clock();
+  paceCollector(end - start, start - vm.lastCollection);
+  vm.lastCollection = end;
+  updateNextGC(); // update-next-gc
 
 // log-after-collect
 #ifdef DEBUG_LOG_GC
@@ -1,21 +1,31 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "map.h"
 #include "memory.h"
 #include "object.h"
 #include "table.h"
+#include "trie.h"
 #include "value.h"
 #include "vm.h"
 
 #define ALLOCATE_OBJ(type, objectType) (type*)allocateObject(sizeof(type), objectType)
+// for objects ending in a flexible array member
+#define ALLOCATE_FLEX(type, objectType, trailing) \
+    (type*)allocateObject(sizeof(type) + (trailing), objectType)
 
 static Obj* allocateObject(size_t size, ObjType type) {
   Obj* object = (Obj*)reallocate(NULL, 0, size);
   object->type = type;
   object->isMarked = false; // Garbage Collection
-  // add-to-list  
-  object->next = vm.objects;
-  vm.objects = object;
+  object->inArena = vm.arena != NULL;
+  object->next = NULL;
+  // add-to-list, arena objects are released with their arena instead
+  if (vm.arena == NULL) {
+    object->next = vm.objects;
+    vm.objects = object;
+  }
 
 // Garbage Collection debug-log-allocate
 #ifdef DEBUG_LOG_GC
@@ -25,23 +35,58 @@ static Obj* allocateObject(size_t size, ObjType type) {
   return object;
 }
 
-ObjClass* newClass(ObjString* name) {
-  ObjClass* definition = ALLOCATE_OBJ(ObjClass, OBJ_CLASS);
+// room for capacity items, the caller fills them in and sets the count
+ObjArray* newArray(int capacity) {
+  ObjArray* array = ALLOCATE_OBJ(ObjArray, OBJ_ARRAY);
+  initValueArray(&array->items);
+  if (capacity > 0) {
+    push(OBJ_VAL(array)); // the buffer can trigger a collection
+    array->items.values = ALLOCATE(Value, capacity);
+    array->items.capacity = capacity;
+    pop();
+  }
+  return array;
+}
+
+// the field names are filled in by the caller
+ObjClass* newClass(Value name, int fieldCount) {
+  ObjClass* definition = ALLOCATE_FLEX(ObjClass, OBJ_CLASS, sizeof(Value) * fieldCount);
   definition->name = name;
+  definition->fieldCount = fieldCount;
+  for (int i = 0; i < fieldCount; i++) {
+    definition->fields[i] = NIL_VAL;
+  }
   return definition;
 }
 
-ObjClosure* newClosure(ObjFunction* function) {
-  // allocate-upvalue-array
-  ObjUpvalue** upvalues = ALLOCATE(ObjUpvalue*, function->upvalueCount);
-  for (int i = 0; i < function->upvalueCount; i++) {
-    upvalues[i] = NULL;
+// the fields are filled in by the caller
+ObjInstance* newInstance(ObjClass* definition) {
+  ObjInstance* instance = ALLOCATE_FLEX(ObjInstance, OBJ_INSTANCE,
+      sizeof(Value) * definition->fieldCount);
+  instance->definition = definition;
+  instance->fieldCount = definition->fieldCount;
+  for (int i = 0; i < instance->fieldCount; i++) {
+    instance->fields[i] = NIL_VAL;
+  }
+  return instance;
+}
+
+// where name sits in the definition's instances, -1 if it has no such field
+int fieldSlot(ObjClass* definition, Value name) {
+  for (int i = 0; i < definition->fieldCount; i++) {
+    if (SAME_KEY(definition->fields[i], name)) return i;
   }
+  return -1;
+}
 
-  ObjClosure* closure = ALLOCATE_OBJ(ObjClosure, OBJ_CLOSURE);
+ObjClosure* newClosure(ObjFunction* function) {
+  ObjClosure* closure = ALLOCATE_FLEX(ObjClosure, OBJ_CLOSURE,
+      sizeof(ObjUpvalue*) * function->upvalueCount);
   closure->function = function;
-  closure->upvalues = upvalues;
   closure->upvalueCount = function->upvalueCount;
+  for (int i = 0; i < function->upvalueCount; i++) {
+    closure->upvalues[i] = NULL;
+  }
   return closure;
 }
 
@@ -60,36 +105,92 @@ ObjNative* newNative(NativeFn function) {
   return native;
 }
 
-static ObjString* allocateString(char* chars, int length, uint32_t hash) {
-  ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+ObjRope* newRope(Value left, Value right, int length) {
+  ObjRope* rope = ALLOCATE_OBJ(ObjRope, OBJ_ROPE);
+  rope->length = length;
+  rope->left = left;
+  rope->right = right;
+  rope->flat = NULL;
+  return rope;
+}
+
+// room for length chars and the terminator, filled in by the caller
+ObjString* newString(int length) {
+  ObjString* string = ALLOCATE_FLEX(ObjString, OBJ_STRING, length + 1);
   string->length = length;
-  string->chars = chars;
-  string->hash = hash;
+  string->hash = 0;
+  string->interned = false;
+  string->chars[length] = '\0';
+  return string;
+}
+
+static ObjString* storeString(ObjString* string) {
+  // compiler strings get interned when the function is promoted
+  if (vm.arena == &vm.compilerArena) return string;
+  string->interned = true;
 //> Hash Tables allocate-store-string
   push(OBJ_VAL(string)); // Garbage Collection push-string
-  tableSet(&vm.strings, string, NIL_VAL);
+  tableSet(&vm.strings, OBJ_VAL(string), NIL_VAL);
   pop(); // Garbage Collection pop-string
 //^ Hash Tables allocate-store-string
   return string;
 }
 
+/*
+  Reads eight bytes per step rather than one, then mixes the last word
+  (zero padded) and the length through a 64 bit finalizer. Never returns
+  0, that marks a string whose hash has not been computed yet.
+*/
 static uint32_t hashString(const char* key, int length) {
-  uint32_t hash = 2166136261u;
-  for (int i = 0; i < length; i++) {
-    hash ^= (uint8_t)key[i];
-    hash *= 16777619;
+  uint64_t hash = 0x9e3779b97f4a7c15u ^ (uint64_t)length;
+  uint64_t word;
+
+  while (length >= 8) {
+    memcpy(&word, key, 8);
+    hash = (hash ^ word) * 0xff51afd7ed558ccdu;
+    hash ^= hash >> 32;
+    key += 8;
+    length -= 8;
   }
-  return hash;
+  word = 0;
+  memcpy(&word, key, length);
+  hash = (hash ^ word) * 0xc4ceb9fe1a85ec53u;
+
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdu;
+  hash ^= hash >> 33;
+  uint32_t result = (uint32_t)hash;
+  return result == 0 ? 1 : result;
 }
 
-ObjString* takeString(char* chars, int length) {
-  uint32_t hash = hashString(chars, length);
-  ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
-  if (interned != NULL) {
-    FREE_ARRAY(char, chars, length + 1);
-    return interned;
+uint32_t stringHash(ObjString* string) {
+  if (string->hash == 0) string->hash = hashString(string->chars, string->length);
+  return string->hash;
+}
+
+// small strings hash like the same text on the heap
+uint32_t textHash(Value text) {
+  if (IS_STRING(text)) return stringHash(AS_STRING(text));
+  char small[SMALL_STRING_MAX];
+  return hashString(textChars(text, small), textLength(text));
+}
+
+// compares the text of two text values, both must be reachable
+bool textsEqual(Value a, Value b) {
+  int length = textLength(a);
+  if (length != textLength(b)) return false;
+
+  if (IS_STRING(a) && IS_STRING(b)) {
+    ObjString* left = AS_STRING(a);
+    ObjString* right = AS_STRING(b);
+    if (left->interned && right->interned) return left == right;
+    if (left->hash != 0 && right->hash != 0 && left->hash != right->hash) return false;
   }
-  return allocateString(chars, length, hash);
+  char leftSmall[SMALL_STRING_MAX];
+  char rightSmall[SMALL_STRING_MAX];
+  const char* left = textChars(a, leftSmall);
+  const char* right = textChars(b, rightSmall);
+  return left == right || memcmp(left, right, length) == 0;
 }
 
 ObjString* copyString(const char* chars, int length) {
@@ -99,12 +200,128 @@ ObjString* copyString(const char* chars, int length) {
   if (interned != NULL) return interned;
 //^ Hash Tables copy-string-hash
 
-  char* heapChars = ALLOCATE(char, length + 1);
-  memcpy(heapChars, chars, length);
-  heapChars[length] = '\0';
+  ObjString* string = newString(length);
+  memcpy(string->chars, chars, length);
+  string->hash = hash;
+  return storeString(string); // Hash Tables copy-string-allocate
+}
+
+// interned like copyString(), unless the text fits in a Value
+Value copyText(const char* chars, int length) {
+  if (fitsSmallString(chars, length)) return smallStringVal(chars, length);
+  return OBJ_VAL(copyString(chars, length));
+}
+
+// text made at runtime, left uninterned when it needs the heap
+Value newText(const char* chars, int length) {
+  if (fitsSmallString(chars, length)) return smallStringVal(chars, length);
+  ObjString* string = newString(length);
+  memcpy(string->chars, chars, length);
+  return OBJ_VAL(string);
+}
+/*
+  Copies the leaves into one (uninterned) string, back to front. Walks with its own
+  stack because ropes built by appending in a loop are as deep as the
+  loop ran. The rope has to be reachable, newString() can collect.
+*/
+ObjString* flattenRope(ObjRope* rope) {
+  if (rope->flat != NULL) return rope->flat;
+
+  ObjString* result = newString(rope->length);
+  push(OBJ_VAL(result)); // growing the scratch stack can collect
+  int end = rope->length;
+
+  // the scratch stack goes through reallocate, so it counts toward the heap limit
+  int capacity = 64;
+  int count = 0;
+  Value* pending = ALLOCATE(Value, capacity);
+  pending[count++] = OBJ_VAL(rope);
+
+  while (count > 0) {
+    Value text = pending[--count];
+    if (IS_ROPE(text) && AS_ROPE(text)->flat == NULL) {
+      if (capacity < count + 2) {
+        pending = GROW_ARRAY(Value, pending, capacity, capacity * 2);
+        capacity *= 2;
+      }
+      pending[count++] = AS_ROPE(text)->left; // right comes off first
+      pending[count++] = AS_ROPE(text)->right;
+      continue;
+    }
+
+    // a leaf, or a rope that was flattened on its own
+    char small[SMALL_STRING_MAX];
+    int length = textLength(text);
+    end -= length;
+    memcpy(result->chars + end, textChars(text, small), length);
+  }
+  FREE_ARRAY(Value, pending, capacity);
+  pop();
+
+  // a rope from before the checkpoint can't keep arena text, it is flattened again on each read
+  if (vm.hasCheckpoint && !rope->obj.inArena) return result;
+
+  rope->flat = result;
+  rope->left = NIL_VAL;
+  rope->right = NIL_VAL;
+  return rope->flat;
+}
+
+int textLength(Value text) {
+  if (IS_SMALL_STRING(text)) return smallStringLength(text);
+  switch (OBJ_TYPE(text)) {
+    case OBJ_ROPE:  return AS_ROPE(text)->length;
+    case OBJ_SLICE: return AS_SLICE(text)->length;
+    default:        return AS_STRING(text)->length;
+  }
+}
+
+/*
+  The text as one run of textLength() chars, not NUL terminated for a
+  slice or a small string, whose chars are copied out into small. Only a
+  rope has to be laid out first, that can collect.
+*/
+const char* textChars(Value text, char* small) {
+  if (IS_SMALL_STRING(text)) {
+    smallStringChars(text, small);
+    return small;
+  }
+  switch (OBJ_TYPE(text)) {
+    case OBJ_ROPE:  return flattenRope(AS_ROPE(text))->chars;
+    case OBJ_SLICE: return AS_SLICE(text)->parent->chars + AS_SLICE(text)->start;
+    default:        return AS_STRING(text)->chars;
+  }
+}
+
+/*
+  Short pieces are cheaper to copy than to point at, and copying them
+  lets a big parent be collected.
+*/
+#define SLICE_MIN_LENGTH 16
 
-  return allocateString(heapChars, length, hash); // Hash Tables copy-string-allocate
+// start and length must already be inside the text, which must be reachable
+Value sliceText(Value text, int start, int length) {
+  if (length < SLICE_MIN_LENGTH) {
+    char small[SMALL_STRING_MAX];
+    return newText(textChars(text, small) + start, length);
+  }
+
+  ObjString* parent;
+  if (IS_SLICE(text)) {
+    start += AS_SLICE(text)->start;
+    parent = AS_SLICE(text)->parent;
+  } else if (IS_ROPE(text)) {
+    parent = flattenRope(AS_ROPE(text));
+  } else {
+    parent = AS_STRING(text); // too long to be a small string
+  }
+  ObjSlice* slice = ALLOCATE_OBJ(ObjSlice, OBJ_SLICE);
+  slice->length = length;
+  slice->start = start;
+  slice->parent = parent;
+  return OBJ_VAL(slice);
 }
+
 // Closures initialize upvalues
 ObjUpvalue* newUpvalue(Value* slot) {
   ObjUpvalue* upvalue = ALLOCATE_OBJ(ObjUpvalue, OBJ_UPVALUE);
@@ -114,6 +331,47 @@ ObjUpvalue* newUpvalue(Value* slot) {
   return upvalue;
 }
 
+ObjList* newList(int count, int shift, ObjTrieNode* root, ObjTrieNode* tail) {
+  ObjList* list = ALLOCATE_OBJ(ObjList, OBJ_LIST);
+  list->count = count;
+  list->shift = shift;
+  list->root = root;
+  list->tail = tail;
+  return list;
+}
+
+ObjMap* newMap() {
+  ObjMap* map = ALLOCATE_OBJ(ObjMap, OBJ_MAP);
+  initMap(map);
+  return map;
+}
+
+ObjTrieMap* newTrieMap(int count, ObjTrieNode* root) {
+  ObjTrieMap* map = ALLOCATE_OBJ(ObjTrieMap, OBJ_TRIE_MAP);
+  map->count = count;
+  map->root = root;
+  return map;
+}
+
+// the slots are filled in by the caller
+ObjTrieNode* newTrieNode(int size) {
+  ObjTrieNode* node = ALLOCATE_FLEX(ObjTrieNode, OBJ_TRIE_NODE, sizeof(Value) * size);
+  node->dataMap = 0;
+  node->nodeMap = 0;
+  node->size = size;
+  for (int i = 0; i < size; i++) {
+    node->slots[i] = NIL_VAL;
+  }
+  return node;
+}
+
+// the values are filled in by the caller
+ObjVector* newVector(int length) {
+  ObjVector* vector = ALLOCATE_FLEX(ObjVector, OBJ_VECTOR, sizeof(double) * length);
+  vector->length = length;
+  return vector;
+}
+
 static void printFunction(ObjFunction* function) {
   if (function->name == NULL) {
     printf("<script>");
@@ -122,10 +380,26 @@ static void printFunction(ObjFunction* function) {
   printf("<fn %s>", function->name->chars);
 }
 
+static void printArray(ObjArray* array) {
+  printf("[");
+  for (int i = 0; i < array->items.count; i++) {
+    if (i > 0) printf(", ");
+    printValue(array->items.values[i]);
+  }
+  printf("]");
+}
+
 void printObject(Value value) { 
   switch (OBJ_TYPE(value)) {
+    case OBJ_ARRAY:
+      printArray(AS_ARRAY(value));
+      break;
     case OBJ_CLASS:
-      printf("%s", AS_CLASS(value)->name->chars);
+      printValue(AS_CLASS(value)->name);
+      break;
+    case OBJ_INSTANCE:
+      printValue(AS_INSTANCE(value)->definition->name);
+      printf(" instance");
       break;
     case OBJ_CLOSURE:
       printFunction(AS_CLOSURE(value)->function);
@@ -136,11 +410,38 @@ void printObject(Value value) {
     case OBJ_NATIVE:
       printf("<native fn>");
       break;
+    case OBJ_ROPE:
+      printf("%s", flattenRope(AS_ROPE(value))->chars);
+      break;
+    case OBJ_SLICE:
+      printf("%.*s", AS_SLICE(value)->length, textChars(value, NULL));
+      break;
     case OBJ_STRING:
       printf("%s", AS_CSTRING(value));
       break;
+    case OBJ_LIST:
+      printList(AS_LIST(value));
+      break;
+    case OBJ_MAP:
+      printMap(AS_MAP(value));
+      break;
+    case OBJ_TRIE_MAP:
+      printTrieMap(AS_TRIE_MAP(value));
+      break;
+    case OBJ_TRIE_NODE:
+      printf("trie node");
+      break;
     case OBJ_UPVALUE:
       printf("upvalue");
       break;
+    case OBJ_VECTOR: {
+      ObjVector* vector = AS_VECTOR(value);
+      printf("vector[");
+      for (int i = 0; i < vector->length; i++) {
+        printf(i == 0 ? "%g" : ", %g", vector->values[i]);
+      }
+      printf("]");
+      break;
+    }
   }
 }
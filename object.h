@@ -9,36 +9,60 @@
 #define OBJ_TYPE(value)        (AS_OBJ(value)->type)
 
 // is ...
-#define IS_CLASS(value)        isObjType(VALUE, OBJ_CLASS)
+#define IS_ARRAY(value)        isObjType(value, OBJ_ARRAY)
+#define IS_CLASS(value)        isObjType(value, OBJ_CLASS)
 #define IS_CLOSURE(value)      isObjType(value, OBJ_CLOSURE)
 #define IS_FUNCTION(value)     isObjType(value, OBJ_FUNCTION)
 #define IS_INSTANCE(value)     isObjType(value, OBJ_INSTANCE)
+#define IS_LIST(value)         isObjType(value, OBJ_LIST)
+#define IS_MAP(value)          isObjType(value, OBJ_MAP)
 #define IS_NATIVE(value)       isObjType(value, OBJ_NATIVE)
+#define IS_ROPE(value)         isObjType(value, OBJ_ROPE)
+#define IS_SLICE(value)        isObjType(value, OBJ_SLICE)
 #define IS_STRING(value)       isObjType(value, OBJ_STRING)
+#define IS_TRIE_MAP(value)     isObjType(value, OBJ_TRIE_MAP)
+#define IS_TEXT(value)         isText(value) // any string representation
+#define IS_VECTOR(value)       isObjType(value, OBJ_VECTOR)
 
 // as ...
+#define AS_ARRAY(value)        ((ObjArray*)AS_OBJ(value))
 #define AS_CLASS(value)        ((ObjClass*)AS_OBJ(value))
 #define AS_CLOSURE(value)      ((ObjClosure*)AS_OBJ(value))
 #define AS_FUNCTION(value)     ((ObjFunction*)AS_OBJ(value))
 #define AS_INSTANCE(value)     ((ObjInstance*)AS_OBJ(value))
+#define AS_LIST(value)         ((ObjList*)AS_OBJ(value))
+#define AS_MAP(value)          ((ObjMap*)AS_OBJ(value))
 #define AS_NATIVE(value)       (((ObjNative*)AS_OBJ(value))->function)
+#define AS_ROPE(value)         ((ObjRope*)AS_OBJ(value))
+#define AS_SLICE(value)        ((ObjSlice*)AS_OBJ(value))
 #define AS_STRING(value)       ((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value)      (((ObjString*)AS_OBJ(value))->chars)
+#define AS_TRIE_MAP(value)     ((ObjTrieMap*)AS_OBJ(value))
+#define AS_VECTOR(value)       ((ObjVector*)AS_OBJ(value))
 
 // structs, enums ...
 typedef enum {
+  OBJ_ARRAY,
   OBJ_CLASS,    // TODO make proper stuct for fields (eventually)
   OBJ_CLOSURE,
   OBJ_FUNCTION,
   OBJ_INSTANCE,
+  OBJ_LIST,
+  OBJ_MAP,
   OBJ_NATIVE,
+  OBJ_ROPE,
+  OBJ_SLICE,
   OBJ_STRING,
-  OBJ_UPVALUE
+  OBJ_TRIE_MAP,
+  OBJ_TRIE_NODE,
+  OBJ_UPVALUE,
+  OBJ_VECTOR
 } ObjType;
 
 struct Obj {
   ObjType type; 
   bool isMarked; // Garbage Collection is-marked-field
+  bool inArena;  // released with an arena, never by the collector
   // object interface ? TODO
   struct Obj* next;
 };
@@ -63,10 +87,35 @@ typedef struct {
 struct ObjString {
   Obj obj;
   int length;
-  char* chars;
-  uint32_t hash;
+  uint32_t hash;   // 0 until something asks for it
+  bool interned;   // only interned strings are in vm.strings, or table keys
+  char chars[];    // stored inline, one allocation per string
 };
 
+/*
+  A concatenation that has not been copied out yet. Joining onto a rope
+  is O(1), the text is only laid out in one buffer the first time its
+  chars are needed. That flat string is kept and the children let go.
+*/
+typedef struct {
+  Obj obj;
+  int length;
+  Value left;      // any text, nil once flattened
+  Value right;
+  ObjString* flat; // NULL until first read
+} ObjRope;
+
+/*
+  A piece of another string, read straight out of the parent's chars.
+  Keeps the parent alive.
+*/
+typedef struct {
+  Obj obj;
+  int length;
+  int start;
+  ObjString* parent; // always a flat string, slices of slices point at the root
+} ObjSlice;
+
 /*
   Upvalue is used in closures
   When a function accesses a constant declared in an enclosing scope
@@ -90,34 +139,128 @@ typedef struct ObjUpvalue {
 typedef struct {
   Obj obj;
   ObjFunction* function;
-  ObjUpvalue** upvalues;
   int upvalueCount;
+  ObjUpvalue* upvalues[]; // stored inline, sized by upvalueCount
 } ObjClosure;
 //^ Closures
 
-typedef struct {
+/*
+  A structure, use { a, b, #c }. Its fields are fixed when it is declared,
+  so the structure is the layout of all its instances: field i is named
+  fields[i] and sits at fields[i] of every instance.
+*/
+typedef struct ObjClass {
   Obj obj;
-  ObjString* name;
+  Value name;
+  int fieldCount;
+  Value fields[]; // the field names, in declaration order
 } ObjClass;
 
 typedef struct {
   Obj obj;
   ObjClass* definition;
-  Table fields; //  TODO update to associative array fixed size
+  int fieldCount; // the definition's, kept for when both are swept together
+  Value fields[];
 } ObjInstance;
 
-ObjClass* newClass(ObjString* name);
+/*
+  [a, b, c], the items laid out back to back in one buffer.
+  Grows the way any ValueArray does.
+*/
+typedef struct {
+  Obj obj;
+  ValueArray items;
+} ObjArray;
+
+/*
+  Numbers only, stored as plain doubles so the vector natives run over
+  them without unboxing. Never changed once it is filled in.
+*/
+typedef struct {
+  Obj obj;
+  int length;
+  double values[];
+} ObjVector;
+
+typedef struct {
+  Value key;     // null once removed
+  Value value;
+  uint32_t hash;
+} MapEntry;
+
+// see map.c
+typedef struct {
+  Obj obj;
+  int count;         // live entries
+  int used;          // entries written, removed ones included
+  int capacity;      // room in entries
+  int indexCapacity; // 0 or a power of two
+  int32_t* index;    // positions in entries, probed by hash
+  MapEntry* entries; // in the order the keys were first added
+} ObjMap;
+
+/*
+  A node of a persistent map or list, see trie.c. Shared between
+  versions, so never changed once it is filled in.
+*/
+typedef struct {
+  Obj obj;
+  uint32_t dataMap; // map nodes, which hash fragments hold a key and value
+  uint32_t nodeMap; // and which hold a child node
+  int size;
+  Value slots[];    // map nodes: the keys and values in pairs, then the children
+} ObjTrieNode;
+
+typedef struct {
+  Obj obj;
+  int count;
+  ObjTrieNode* root;
+} ObjTrieMap;
+
+typedef struct {
+  Obj obj;
+  int count;
+  int shift;         // how many bits of an index the root's level uses
+  ObjTrieNode* root;
+  ObjTrieNode* tail; // the last items, not in the tree yet
+} ObjList;
+
+ObjArray* newArray(int capacity);
+ObjClass* newClass(Value name, int fieldCount);
 ObjClosure* newClosure(ObjFunction* function);
 ObjFunction* newFunction();
-ObjInstance* newInstance();
+ObjInstance* newInstance(ObjClass* definition);
+ObjList* newList(int count, int shift, ObjTrieNode* root, ObjTrieNode* tail);
+ObjMap* newMap();
+int fieldSlot(ObjClass* definition, Value name);
 ObjNative* newNative(NativeFn function);
-ObjString* takeString(char* chars, int length);
+ObjRope* newRope(Value left, Value right, int length);
+ObjString* flattenRope(ObjRope* rope);
+Value sliceText(Value text, int start, int length);
+Value copyText(const char* chars, int length);
+Value newText(const char* chars, int length);
+uint32_t textHash(Value text);
+int textLength(Value text);
+const char* textChars(Value text, char* small);
+ObjString* newString(int length);
+uint32_t stringHash(ObjString* string);
+bool textsEqual(Value a, Value b);
 ObjString* copyString(const char* chars, int length);
+ObjTrieMap* newTrieMap(int count, ObjTrieNode* root);
+ObjTrieNode* newTrieNode(int size);
 ObjUpvalue* newUpvalue(Value* slot);
+ObjVector* newVector(int length);
 void printObject(Value value);
 
 static inline bool isObjType(Value value, ObjType type) {
   return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
 
+static inline bool isText(Value value) {
+  if (IS_SMALL_STRING(value)) return true;
+  if (!IS_OBJ(value)) return false;
+  ObjType type = AS_OBJ(value)->type;
+  return type == OBJ_STRING || type == OBJ_ROPE || type == OBJ_SLICE;
+}
+
 #endif
@@ -80,8 +80,9 @@ void advance() {
 }
 
 bool consume(Lexeme glyph) {
-  if (tokenIs(glyph)) advance();
-  return parser.previous.lexeme == glyph;
+  if (tokenIsNot(glyph)) return false;
+  advance();
+  return true;
 }
 
 void require(Lexeme test, const char* message) {
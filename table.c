@@ -1,118 +1,201 @@
 #include <stdlib.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "memory.h"
 #include "object.h"
 #include "table.h"
 #include "value.h"
 
-#define TABLE_MAX_LOAD 0.75
+// at most 7/8 of the slots hold entries or tombstones
+#define TABLE_MAX_LOAD(capacity) ((capacity) - (capacity) / 8)
+
+#define CONTROL_EMPTY   0x80
+#define CONTROL_DELETED 0xfe
+// a full slot's control byte is the low 7 bits of its hash, the rest picks the group
+#define HASH_TAG(hash)   ((uint8_t)((hash) & 0x7f))
+#define HASH_GROUP(hash) ((hash) >> 7)
+
+
+//> group matching, bit i is set for each of the group's slots that match
+#ifdef __SSE2__
+static inline uint32_t matchTag(const uint8_t* group, uint8_t tag) {
+  __m128i control = _mm_loadu_si128((const __m128i*)group);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8((char)tag)));
+}
+// empty or deleted, the only bytes with the high bit set
+static inline uint32_t matchFree(const uint8_t* group) {
+  return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+}
+#else
+static inline uint32_t matchTag(const uint8_t* group, uint8_t tag) {
+  uint32_t mask = 0;
+  for (int i = 0; i < TABLE_GROUP; i++) {
+    if (group[i] == tag) mask |= 1u << i;
+  }
+  return mask;
+}
+static inline uint32_t matchFree(const uint8_t* group) {
+  uint32_t mask = 0;
+  for (int i = 0; i < TABLE_GROUP; i++) {
+    if (group[i] & 0x80) mask |= 1u << i;
+  }
+  return mask;
+}
+#endif
+static inline uint32_t matchEmpty(const uint8_t* group) {
+  return matchTag(group, CONTROL_EMPTY);
+}
+//^ group matching
+
+static inline int nextMatch(uint32_t* mask) {
+  int slot = __builtin_ctz(*mask);
+  *mask &= *mask - 1;
+  return slot;
+}
+
+static inline bool isFull(uint8_t control) { return (control & 0x80) == 0; }
 
 void initTable(Table* table) {
   table->count = 0;
+  table->tombstones = 0;
   table->capacity = 0;
+  table->control = NULL;
   table->entries = NULL;
 }
 void freeTable(Table* table) {
+  FREE_ARRAY(uint8_t, table->control, table->capacity);
   FREE_ARRAY(Entry, table->entries, table->capacity);
   initTable(table);
 }
 
-static Entry* findEntry(Entry* entries, int capacity, ObjString* key) {
-  uint32_t index = key->hash & (capacity - 1);
-  Entry* tombstone = NULL;
-  
-  for (;;) {
-    Entry* entry = &entries[index];
+/*
+  Groups are probed triangularly, 1, 2, 3... groups apart, which visits
+  every group of a power of two table. A group with an empty slot ends the
+  probe, the key would have been placed there.
+*/
+static Entry* findEntry(Table* table, Value key) {
+  if (table->count == 0) return NULL;
 
-//> find-tombstone
-    if (entry->key == NULL) {
-      if (IS_NIL(entry->value)) { // Empty entry.
-        return tombstone != NULL ? tombstone : entry;
-      } else { // We found a tombstone.
-        if (tombstone == NULL) tombstone = entry;
-      }
-    } else if (entry->key == key) { // We found the key.
-      return entry;
+  uint32_t hash = textHash(key);
+  uint8_t tag = HASH_TAG(hash);
+  uint32_t groupMask = (uint32_t)(table->capacity / TABLE_GROUP) - 1;
+  uint32_t group = HASH_GROUP(hash) & groupMask;
+
+  for (uint32_t stride = 1; ; stride++) {
+    const uint8_t* control = table->control + group * TABLE_GROUP;
+    uint32_t match = matchTag(control, tag);
+    while (match != 0) {
+      Entry* entry = &table->entries[group * TABLE_GROUP + nextMatch(&match)];
+      if (SAME_KEY(entry->key, key)) return entry;
     }
-//^ find-tombstone
-    index = (index + 1) & (capacity - 1);
+    if (matchEmpty(control) != 0) return NULL;
+    group = (group + stride) & groupMask;
   }
 }
 
-bool tableGet(Table* table, ObjString* key, Value* value) {
-  if (table->count == 0) return false;
-
-  Entry* entry = findEntry(table->entries, table->capacity, key);
-  if (entry->key == NULL) return false;
+// the first empty or deleted slot on the key's probe path
+static int findFreeSlot(Table* table, uint32_t hash) {
+  uint32_t groupMask = (uint32_t)(table->capacity / TABLE_GROUP) - 1;
+  uint32_t group = HASH_GROUP(hash) & groupMask;
 
-  *value = entry->value;
-  return true;
+  for (uint32_t stride = 1; ; stride++) {
+    uint32_t free = matchFree(table->control + group * TABLE_GROUP);
+    if (free != 0) return (int)(group * TABLE_GROUP) + nextMatch(&free);
+    group = (group + stride) & groupMask;
+  }
 }
 
-bool peekTable(Table* table, ObjString* key) {
-  if (table->count == 0) return false;
-
-  Entry* entry = findEntry(table->entries, table->capacity, key);
-  return entry->key != NULL;
+static void insertNew(Table* table, Value key, Value value, uint32_t hash) {
+  int slot = findFreeSlot(table, hash);
+  if (table->control[slot] == CONTROL_DELETED) table->tombstones--;
+  table->control[slot] = HASH_TAG(hash);
+  table->entries[slot].key = key;
+  table->entries[slot].value = value;
+  table->count++;
 }
 
+// re-places every live entry into fresh arrays, which also drops the tombstones
 static void adjustCapacity(Table* table, int capacity) {
-  Entry* entries = ALLOCATE(Entry, capacity);
-  for (int i = 0; i < capacity; i++) {
-    entries[i].key = NULL;
-    entries[i].value = NIL_VAL;
-  }
+  Table resized;
+  initTable(&resized);
+  resized.control = ALLOCATE(uint8_t, capacity);
+  resized.entries = ALLOCATE(Entry, capacity);
+  resized.capacity = capacity;
+  memset(resized.control, CONTROL_EMPTY, capacity);
+
 //> re-hash
-  table->count = 0;
   for (int i = 0; i < table->capacity; i++) {
+    if (!isFull(table->control[i])) continue;
     Entry* entry = &table->entries[i];
-    if (entry->key == NULL) continue;
-
-    Entry* dest = findEntry(entries, capacity, entry->key);
-    dest->key = entry->key;
-    dest->value = entry->value;
-    table->count++;
+    insertNew(&resized, entry->key, entry->value, textHash(entry->key));
   }
 //^ re-hash
 
-  FREE_ARRAY(Entry, table->entries, table->capacity);
-  table->entries = entries;
-  table->capacity = capacity;
+  freeTable(table);
+  *table = resized;
 }
 
-bool tableSet(Table* table, ObjString* key, Value value) {
-  if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-    int capacity = GROW_CAPACITY(table->capacity);
-    adjustCapacity(table, capacity);
-  }
+bool tableGet(Table* table, Value key, Value* value) {
+  Entry* entry = findEntry(table, key);
+  if (entry == NULL) return false;
 
-  Entry* entry = findEntry(table->entries, table->capacity, key);
-  bool isNewKey = entry->key == NULL;
+  *value = entry->value;
+  return true;
+}
 
-  if (isNewKey && IS_NIL(entry->value)) table->count++;
+bool peekTable(Table* table, Value key) {
+  return findEntry(table, key) != NULL;
+}
+
+bool tableSet(Table* table, Value key, Value value) {
+  Entry* entry = findEntry(table, key);
+  if (entry != NULL) {
+    entry->value = value;
+    return false;
+  }
 
-  entry->key = key;
-  entry->value = value;
-  return isNewKey;
+  if (table->count + table->tombstones + 1 > TABLE_MAX_LOAD(table->capacity)) {
+    // mostly tombstones, the same size cleaned up is enough
+    bool clean = table->count + 1 <= TABLE_MAX_LOAD(table->capacity) / 2;
+    adjustCapacity(table, clean ? table->capacity
+        : (table->capacity < TABLE_GROUP ? TABLE_GROUP : table->capacity * 2));
+  }
+  insertNew(table, key, value, textHash(key));
+  return true;
+}
+
+/*
+  A slot whose group still has an empty one can go straight back to
+  empty, every probe through that group stops there anyway.
+*/
+static void removeSlot(Table* table, int slot) {
+  const uint8_t* group = table->control + (slot / TABLE_GROUP) * TABLE_GROUP;
+  if (matchEmpty(group) != 0) {
+    table->control[slot] = CONTROL_EMPTY;
+  } else {
+    table->control[slot] = CONTROL_DELETED;
+    table->tombstones++;
+  }
+  table->entries[slot].key = NIL_VAL;
+  table->entries[slot].value = NIL_VAL;
+  table->count--;
 }
-bool tableDelete(Table* table, ObjString* key) {
-  if (table->count == 0) return false;
 
-  Entry* entry = findEntry(table->entries, table->capacity, key);
-  if (entry->key == NULL) return false;
+bool tableDelete(Table* table, Value key) {
+  Entry* entry = findEntry(table, key);
+  if (entry == NULL) return false;
 
-  // Place a tombstone in the entry.
-  entry->key = NULL;
-  entry->value = BOOL_VAL(true);
+  removeSlot(table, (int)(entry - table->entries));
   return true;
 }
 
 void tableAddAll(Table* from, Table* to) {
   for (int i = 0; i < from->capacity; i++) {
-    Entry* entry = &from->entries[i];
-    if (entry->key != NULL) {
-      tableSet(to, entry->key, entry->value);
+    if (isFull(from->control[i])) {
+      tableSet(to, from->entries[i].key, from->entries[i].value);
     }
   }
 }
@@ -120,37 +203,71 @@ void tableAddAll(Table* from, Table* to) {
 ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash) {
   if (table->count == 0) return NULL;
 
-  uint32_t index = hash & (table->capacity - 1);
-
-  for (;;) {
-    Entry* entry = &table->entries[index];
-    if (entry->key == NULL) {
-      // Stop if we find an empty non-tombstone entry.
-      if (IS_NIL(entry->value)) return NULL;
-    } else if (entry->key->length == length &&
-        entry->key->hash == hash &&
-        memcmp(entry->key->chars, chars, length) == 0) {
-      // We found it.
-      return entry->key;
+  uint8_t tag = HASH_TAG(hash);
+  uint32_t groupMask = (uint32_t)(table->capacity / TABLE_GROUP) - 1;
+  uint32_t group = HASH_GROUP(hash) & groupMask;
+
+  for (uint32_t stride = 1; ; stride++) {
+    const uint8_t* control = table->control + group * TABLE_GROUP;
+    uint32_t match = matchTag(control, tag);
+    while (match != 0) {
+      Value key = table->entries[group * TABLE_GROUP + nextMatch(&match)].key;
+      if (!IS_STRING(key)) continue;
+      ObjString* string = AS_STRING(key);
+      if (string->length == length && string->hash == hash &&
+          memcmp(string->chars, chars, length) == 0) {
+        return string; // We found it.
+      }
     }
-    //find-string-next
-    index = (index + 1) & (table->capacity - 1);
+    // Stop if the group has an empty slot.
+    if (matchEmpty(control) != 0) return NULL;
+    group = (group + stride) & groupMask;
+  }
+}
+
+void snapshotTable(Table* table, TableSnapshot* snapshot) {
+  snapshot->table = *table;
+  snapshot->savedControl = ALLOCATE(uint8_t, table->capacity);
+  snapshot->saved = ALLOCATE(Entry, table->capacity);
+  if (table->capacity > 0) {
+    memcpy(snapshot->savedControl, table->control, table->capacity);
+    memcpy(snapshot->saved, table->entries, sizeof(Entry) * table->capacity);
+  }
+}
+
+/*
+  Whatever was written since the snapshot is dropped. A table that grew in
+  the meantime simply lets go of its newer arrays, the caller owns that memory.
+*/
+void restoreTable(Table* table, TableSnapshot* snapshot) {
+  *table = snapshot->table;
+  if (table->capacity > 0) {
+    memcpy(table->control, snapshot->savedControl, table->capacity);
+    memcpy(table->entries, snapshot->saved, sizeof(Entry) * table->capacity);
   }
 }
+
+void freeSnapshot(TableSnapshot* snapshot) {
+  FREE_ARRAY(uint8_t, snapshot->savedControl, snapshot->table.capacity);
+  FREE_ARRAY(Entry, snapshot->saved, snapshot->table.capacity);
+  snapshot->savedControl = NULL;
+  snapshot->saved = NULL;
+  initTable(&snapshot->table);
+}
+
 // Garbage Collection
 void tableRemoveWhite(Table* table) {
   for (int i = 0; i < table->capacity; i++) {
-    Entry* entry = &table->entries[i];
-    if (entry->key != NULL && !entry->key->obj.isMarked) {
-      tableDelete(table, entry->key);
-    }
+    if (!isFull(table->control[i])) continue;
+    Value key = table->entries[i].key;
+    if (IS_OBJ(key) && !AS_OBJ(key)->isMarked) removeSlot(table, i);
   }
 }
 // Garbage Collection
 void markTable(Table* table) {
   for (int i = 0; i < table->capacity; i++) {
-    Entry* entry = &table->entries[i];
-    markObject((Obj*)entry->key);
-    markValue(entry->value);
+    if (!isFull(table->control[i])) continue;
+    markValue(table->entries[i].key);
+    markValue(table->entries[i].value);
   }
 }
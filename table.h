@@ -4,25 +4,51 @@
 #include "common.h"
 #include "value.h"
 
+// keys are small strings or interned ObjStrings, so equal keys are equal Values
 typedef struct {
-  ObjString* key;
+  Value key;
   Value value;
 } Entry;
 
+#ifdef NAN_BOXING
+#define SAME_KEY(a, b) ((a) == (b))
+#else
+#define SAME_KEY(a, b) ((a).type == (b).type && (a).as.obj == (b).as.obj)
+#endif
+
+/*
+  Open addressing in groups of TABLE_GROUP slots. Each slot has a control
+  byte, either empty, deleted or 7 bits of its key's hash, so a whole group
+  is checked with one compare before any entry is read.
+*/
+#define TABLE_GROUP 16
+
 typedef struct {
-  int count;
-  int capacity;
+  int count;      // live entries
+  int tombstones; // deleted slots still in probe chains
+  int capacity;   // 0 or a power of two, at least TABLE_GROUP
+  uint8_t* control;
   Entry* entries;
 } Table;
 
+// a table's state saved aside, so it can be put back after later writes
+typedef struct {
+  Table table;           // the table as it was, holding the arrays it owned then
+  uint8_t* savedControl; // copies of those arrays
+  Entry* saved;
+} TableSnapshot;
+
 void initTable(Table* table);
 void freeTable(Table* table);
-bool tableGet(Table* table, ObjString* key, Value* value);
-bool peekTable(Table* table, ObjString* key);
-bool tableSet(Table* table, ObjString* key, Value value);
-bool tableDelete(Table* table, ObjString* key);
+bool tableGet(Table* table, Value key, Value* value);
+bool peekTable(Table* table, Value key);
+bool tableSet(Table* table, Value key, Value value);
+bool tableDelete(Table* table, Value key);
 void tableAddAll(Table* from, Table* to);
 ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash);
+void snapshotTable(Table* table, TableSnapshot* snapshot);
+void restoreTable(Table* table, TableSnapshot* snapshot);
+void freeSnapshot(TableSnapshot* snapshot);
 
 // Garbage Collection
 void tableRemoveWhite(Table* table);
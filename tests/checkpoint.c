@@ -0,0 +1,33 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../memory.h"
+#include "../vm.h"
+
+/*
+  Request checkpoints are only reachable from a host, this is one.
+  Build it with the VM, leaving out app.c:
+    cc -o checkpoint tests/checkpoint.c $(ls *.c | grep -v app.c) -lm
+  Each print names what it must show, it exits non-zero on an error.
+*/
+static void run(const char* source) {
+  if (interpret(source) != INTERPRET_OK) exit(70);
+}
+
+int main() {
+  initVM();
+
+  // a rope made before the checkpoint, first read inside it
+  run("as part: \"abcdefghijklmnopqrstuvwxyz0123456789abcdef\"\n"
+      "as r: part .. part\n");
+  markCheckpoint();
+  run("print(r)\n"); // abcdefghijklmnopqrstuvwxyz0123456789abcdefabcdefghijklmnopqrstuvwxyz0123456789abcdef
+  resetToCheckpoint();
+  run("print(r)\n"); // same text again
+  dropCheckpoint();
+  collectGarbage(); // marks r, its text must still be its own
+  run("print(r)\n"); // same text again
+
+  freeVM();
+  return 0;
+}
@@ -0,0 +1,397 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "memory.h"
+#include "trie.h"
+#include "vm.h"
+
+// a map node this deep has used every bit of the hash, keys that reach it collide
+#define HASH_LIMIT 32
+#define FRAGMENT(hash, shift) (((hash) >> (shift)) & TRIE_MASK)
+#define AS_NODE(value) ((ObjTrieNode*)AS_OBJ(value))
+
+//> Nodes
+/*
+  Every node made here is new, so it is pushed while the next one is
+  allocated. The nodes it was copied from belong to the old version and
+  are reachable through it.
+*/
+static ObjTrieNode* copyNode(ObjTrieNode* node, int size) {
+  ObjTrieNode* copy = newTrieNode(size);
+  copy->dataMap = node->dataMap;
+  copy->nodeMap = node->nodeMap;
+  return copy;
+}
+
+// node with slot replaced by value
+static ObjTrieNode* withSlot(ObjTrieNode* node, int slot, Value value) {
+  push(value);
+  ObjTrieNode* copy = copyNode(node, node->size);
+  memcpy(copy->slots, node->slots, sizeof(Value) * node->size);
+  copy->slots[slot] = value;
+  pop();
+  return copy;
+}
+
+// node with value after its last slot
+static ObjTrieNode* withAppended(ObjTrieNode* node, Value value) {
+  push(value);
+  ObjTrieNode* copy = copyNode(node, node->size + 1);
+  memcpy(copy->slots, node->slots, sizeof(Value) * node->size);
+  copy->slots[node->size] = value;
+  pop();
+  return copy;
+}
+//^ Nodes
+
+//> Map nodes
+/*
+  A map node keeps its keys and values in pairs followed by its child
+  nodes, dataMap and nodeMap say which hash fragments are which. Below
+  HASH_LIMIT a node is only pairs, the keys whose whole hash collided.
+*/
+static int pairCount(ObjTrieNode* node) {
+  return __builtin_popcount(node->dataMap);
+}
+
+static int pairSlot(ObjTrieNode* node, uint32_t bit) {
+  return 2 * __builtin_popcount(node->dataMap & (bit - 1));
+}
+
+static int childSlot(ObjTrieNode* node, uint32_t bit) {
+  return 2 * pairCount(node) + __builtin_popcount(node->nodeMap & (bit - 1));
+}
+
+static ObjTrieNode* withPair(ObjTrieNode* node, uint32_t bit, Value key, Value value) {
+  int pair = pairSlot(node, bit);
+  ObjTrieNode* copy = copyNode(node, node->size + 2);
+  copy->dataMap |= bit;
+  memcpy(copy->slots, node->slots, sizeof(Value) * pair);
+  copy->slots[pair] = key;
+  copy->slots[pair + 1] = value;
+  memcpy(copy->slots + pair + 2, node->slots + pair, sizeof(Value) * (node->size - pair));
+  return copy;
+}
+
+// bit is 0 in a collision node, where the pair is found by looking
+static ObjTrieNode* withoutPair(ObjTrieNode* node, int pair, uint32_t bit) {
+  ObjTrieNode* copy = copyNode(node, node->size - 2);
+  copy->dataMap ^= bit;
+  memcpy(copy->slots, node->slots, sizeof(Value) * pair);
+  memcpy(copy->slots + pair, node->slots + pair + 2, sizeof(Value) * (node->size - pair - 2));
+  return copy;
+}
+
+// the pair at bit moves down into child
+static ObjTrieNode* pairToChild(ObjTrieNode* node, uint32_t bit, ObjTrieNode* child) {
+  int pair = pairSlot(node, bit);
+  push(OBJ_VAL(child));
+  ObjTrieNode* copy = copyNode(node, node->size - 1);
+  copy->dataMap ^= bit;
+  copy->nodeMap |= bit;
+  int slot = childSlot(copy, bit);
+  memcpy(copy->slots, node->slots, sizeof(Value) * pair);
+  memcpy(copy->slots + pair, node->slots + pair + 2, sizeof(Value) * (slot - pair));
+  copy->slots[slot] = OBJ_VAL(child);
+  memcpy(copy->slots + slot + 1, node->slots + slot + 2, sizeof(Value) * (node->size - slot - 2));
+  pop();
+  return copy;
+}
+
+// the child at bit is down to one pair, it moves back up
+static ObjTrieNode* childToPair(ObjTrieNode* node, uint32_t bit, Value key, Value value) {
+  int slot = childSlot(node, bit);
+  ObjTrieNode* copy = copyNode(node, node->size + 1);
+  copy->dataMap |= bit;
+  copy->nodeMap ^= bit;
+  int pair = pairSlot(copy, bit);
+  memcpy(copy->slots, node->slots, sizeof(Value) * pair);
+  copy->slots[pair] = key;
+  copy->slots[pair + 1] = value;
+  memcpy(copy->slots + pair + 2, node->slots + pair, sizeof(Value) * (slot - pair));
+  memcpy(copy->slots + slot + 2, node->slots + slot + 1, sizeof(Value) * (node->size - slot - 1));
+  return copy;
+}
+
+// a node holding two keys whose hashes agree up to shift
+static ObjTrieNode* mergePairs(int shift, Value key1, Value value1, uint32_t hash1,
+                               Value key2, Value value2, uint32_t hash2) {
+  if (shift >= HASH_LIMIT) {
+    ObjTrieNode* node = newTrieNode(4);
+    node->slots[0] = key1;
+    node->slots[1] = value1;
+    node->slots[2] = key2;
+    node->slots[3] = value2;
+    return node;
+  }
+  uint32_t fragment1 = FRAGMENT(hash1, shift);
+  uint32_t fragment2 = FRAGMENT(hash2, shift);
+  if (fragment1 == fragment2) {
+    ObjTrieNode* child = mergePairs(shift + TRIE_BITS, key1, value1, hash1, key2, value2, hash2);
+    push(OBJ_VAL(child));
+    ObjTrieNode* node = newTrieNode(1);
+    node->nodeMap = 1u << fragment1;
+    node->slots[0] = OBJ_VAL(child);
+    pop();
+    return node;
+  }
+  ObjTrieNode* node = newTrieNode(4);
+  node->dataMap = (1u << fragment1) | (1u << fragment2);
+  int first = fragment1 < fragment2 ? 0 : 2;
+  node->slots[first] = key1;
+  node->slots[first + 1] = value1;
+  node->slots[2 - first] = key2;
+  node->slots[3 - first] = value2;
+  return node;
+}
+
+static ObjTrieNode* putNode(ObjTrieNode* node, int shift, uint32_t hash,
+                            Value key, Value value, bool* added) {
+  if (shift >= HASH_LIMIT) {
+    for (int pair = 0; pair < node->size; pair += 2) {
+      if (valuesEqual(node->slots[pair], key)) return withSlot(node, pair + 1, value);
+    }
+    *added = true;
+    ObjTrieNode* copy = withAppended(node, key);
+    push(OBJ_VAL(copy));
+    copy = withAppended(copy, value);
+    pop();
+    return copy;
+  }
+
+  uint32_t bit = 1u << FRAGMENT(hash, shift);
+  if (node->dataMap & bit) {
+    int pair = pairSlot(node, bit);
+    Value existing = node->slots[pair];
+    if (valuesEqual(existing, key)) return withSlot(node, pair + 1, value);
+    *added = true;
+    ObjTrieNode* child = mergePairs(shift + TRIE_BITS, existing, node->slots[pair + 1],
+        hashValue(existing), key, value, hash);
+    return pairToChild(node, bit, child);
+  }
+  if (node->nodeMap & bit) {
+    int slot = childSlot(node, bit);
+    ObjTrieNode* child = putNode(AS_NODE(node->slots[slot]), shift + TRIE_BITS,
+        hash, key, value, added);
+    return withSlot(node, slot, OBJ_VAL(child));
+  }
+  *added = true;
+  return withPair(node, bit, key, value);
+}
+
+// node itself when key is not in it
+static ObjTrieNode* removeNode(ObjTrieNode* node, int shift, uint32_t hash,
+                               Value key, bool* removed) {
+  if (shift >= HASH_LIMIT) {
+    for (int pair = 0; pair < node->size; pair += 2) {
+      if (!valuesEqual(node->slots[pair], key)) continue;
+      *removed = true;
+      return withoutPair(node, pair, 0);
+    }
+    return node;
+  }
+
+  uint32_t bit = 1u << FRAGMENT(hash, shift);
+  if (node->dataMap & bit) {
+    int pair = pairSlot(node, bit);
+    if (!valuesEqual(node->slots[pair], key)) return node;
+    *removed = true;
+    return withoutPair(node, pair, bit);
+  }
+  if (node->nodeMap & bit) {
+    int slot = childSlot(node, bit);
+    ObjTrieNode* child = removeNode(AS_NODE(node->slots[slot]), shift + TRIE_BITS,
+        hash, key, removed);
+    if (!*removed) return node;
+    // a lone pair is kept in its parent, so equal maps have the same shape
+    if (child->nodeMap == 0 && child->size == 2) {
+      return childToPair(node, bit, child->slots[0], child->slots[1]);
+    }
+    return withSlot(node, slot, OBJ_VAL(child));
+  }
+  return node;
+}
+
+static ObjTrieMap* wrapMap(int count, ObjTrieNode* root) {
+  push(OBJ_VAL(root));
+  ObjTrieMap* map = newTrieMap(count, root);
+  pop();
+  return map;
+}
+
+ObjTrieMap* emptyTrieMap() {
+  return wrapMap(0, newTrieNode(0));
+}
+
+bool trieMapGet(ObjTrieMap* map, Value key, Value* value) {
+  uint32_t hash = hashValue(key);
+  ObjTrieNode* node = map->root;
+  for (int shift = 0; shift < HASH_LIMIT; shift += TRIE_BITS) {
+    uint32_t bit = 1u << FRAGMENT(hash, shift);
+    if (node->dataMap & bit) {
+      int pair = pairSlot(node, bit);
+      if (!valuesEqual(node->slots[pair], key)) return false;
+      *value = node->slots[pair + 1];
+      return true;
+    }
+    if (!(node->nodeMap & bit)) return false;
+    node = AS_NODE(node->slots[childSlot(node, bit)]);
+  }
+  for (int pair = 0; pair < node->size; pair += 2) {
+    if (valuesEqual(node->slots[pair], key)) {
+      *value = node->slots[pair + 1];
+      return true;
+    }
+  }
+  return false;
+}
+
+ObjTrieMap* trieMapPut(ObjTrieMap* map, Value key, Value value) {
+  bool added = false;
+  ObjTrieNode* root = putNode(map->root, 0, hashValue(key), key, value, &added);
+  return wrapMap(map->count + added, root);
+}
+
+ObjTrieMap* trieMapRemove(ObjTrieMap* map, Value key) {
+  bool removed = false;
+  ObjTrieNode* root = removeNode(map->root, 0, hashValue(key), key, &removed);
+  return removed ? wrapMap(map->count - 1, root) : map;
+}
+//^ Map nodes
+
+//> List nodes
+/*
+  A list is a tree of 32 way nodes, the leaves hold the items in order.
+  The last few items wait in a tail that is not part of the tree yet, so
+  a push copies at most the tail until it fills up.
+*/
+static int tailOffset(ObjList* list) {
+  return list->count < TRIE_WIDTH ? 0 : ((list->count - 1) >> TRIE_BITS) << TRIE_BITS;
+}
+
+static ObjList* wrapList(int count, int shift, ObjTrieNode* root, ObjTrieNode* tail) {
+  push(OBJ_VAL(root));
+  push(OBJ_VAL(tail));
+  ObjList* list = newList(count, shift, root, tail);
+  pop();
+  pop();
+  return list;
+}
+
+ObjList* emptyList() {
+  ObjTrieNode* root = newTrieNode(0);
+  push(OBJ_VAL(root));
+  ObjList* list = wrapList(0, TRIE_BITS, root, newTrieNode(0));
+  pop();
+  return list;
+}
+
+// index must be inside the list
+Value listGet(ObjList* list, int index) {
+  int offset = tailOffset(list);
+  if (index >= offset) return list->tail->slots[index - offset];
+  ObjTrieNode* node = list->root;
+  for (int level = list->shift; level > 0; level -= TRIE_BITS) {
+    node = AS_NODE(node->slots[(index >> level) & TRIE_MASK]);
+  }
+  return node->slots[index & TRIE_MASK];
+}
+
+// a chain of single child nodes from level down to leaf
+static ObjTrieNode* newPath(int level, ObjTrieNode* leaf) {
+  if (level == 0) return leaf;
+  ObjTrieNode* below = newPath(level - TRIE_BITS, leaf);
+  push(OBJ_VAL(below));
+  ObjTrieNode* node = newTrieNode(1);
+  node->slots[0] = OBJ_VAL(below);
+  pop();
+  return node;
+}
+
+// parent with the full tail hung after its last leaf
+static ObjTrieNode* pushTail(ObjList* list, int level, ObjTrieNode* parent, ObjTrieNode* tail) {
+  int child = ((list->count - 1) >> level) & TRIE_MASK;
+  if (level == TRIE_BITS) return withAppended(parent, OBJ_VAL(tail));
+  if (child < parent->size) {
+    ObjTrieNode* below = pushTail(list, level - TRIE_BITS, AS_NODE(parent->slots[child]), tail);
+    return withSlot(parent, child, OBJ_VAL(below));
+  }
+  return withAppended(parent, OBJ_VAL(newPath(level - TRIE_BITS, tail)));
+}
+
+ObjList* listPush(ObjList* list, Value value) {
+  if (list->count - tailOffset(list) < TRIE_WIDTH) {
+    ObjTrieNode* tail = withAppended(list->tail, value);
+    return wrapList(list->count + 1, list->shift, list->root, tail);
+  }
+
+  // the tail is full, it goes into the tree and a new one starts
+  int shift = list->shift;
+  ObjTrieNode* root;
+  if ((list->count >> TRIE_BITS) > (1 << list->shift)) {
+    ObjTrieNode* path = newPath(list->shift, list->tail);
+    push(OBJ_VAL(path));
+    root = newTrieNode(2);
+    root->slots[0] = OBJ_VAL(list->root);
+    root->slots[1] = OBJ_VAL(path);
+    pop();
+    shift += TRIE_BITS;
+  } else {
+    root = pushTail(list, list->shift, list->root, list->tail);
+  }
+  push(OBJ_VAL(root));
+  ObjTrieNode* tail = newTrieNode(1);
+  tail->slots[0] = value;
+  ObjList* longer = wrapList(list->count + 1, shift, root, tail);
+  pop();
+  return longer;
+}
+
+static ObjTrieNode* putLeaf(int level, ObjTrieNode* node, int index, Value value) {
+  if (level == 0) return withSlot(node, index & TRIE_MASK, value);
+  int child = (index >> level) & TRIE_MASK;
+  ObjTrieNode* below = putLeaf(level - TRIE_BITS, AS_NODE(node->slots[child]), index, value);
+  return withSlot(node, child, OBJ_VAL(below));
+}
+
+// index must be inside the list
+ObjList* listPut(ObjList* list, int index, Value value) {
+  int offset = tailOffset(list);
+  if (index >= offset) {
+    ObjTrieNode* tail = withSlot(list->tail, index - offset, value);
+    return wrapList(list->count, list->shift, list->root, tail);
+  }
+  ObjTrieNode* root = putLeaf(list->shift, list->root, index, value);
+  return wrapList(list->count, list->shift, root, list->tail);
+}
+//^ List nodes
+
+static void printMapNode(ObjTrieNode* node, int shift, bool* first) {
+  int pairs = shift >= HASH_LIMIT ? node->size : 2 * pairCount(node);
+  for (int pair = 0; pair < pairs; pair += 2) {
+    printf(*first ? "" : ", ");
+    *first = false;
+    printValue(node->slots[pair]);
+    printf(": ");
+    printValue(node->slots[pair + 1]);
+  }
+  for (int slot = pairs; slot < node->size; slot++) {
+    printMapNode(AS_NODE(node->slots[slot]), shift + TRIE_BITS, first);
+  }
+}
+
+void printTrieMap(ObjTrieMap* map) {
+  bool first = true;
+  printf("map{");
+  printMapNode(map->root, 0, &first);
+  printf("}");
+}
+
+void printList(ObjList* list) {
+  printf("list[");
+  for (int i = 0; i < list->count; i++) {
+    if (i > 0) printf(", ");
+    printValue(listGet(list, i));
+  }
+  printf("]");
+}
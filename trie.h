@@ -0,0 +1,28 @@
+#ifndef mu_trie_h
+#define mu_trie_h
+
+#include "object.h"
+
+/*
+  Persistent maps and lists. Every change gives back a new version that
+  copies only the nodes on the path to the change, the rest are shared
+  with the old version, which stays as it was.
+*/
+#define TRIE_BITS  5
+#define TRIE_WIDTH (1 << TRIE_BITS) // 32 children per node
+#define TRIE_MASK  (TRIE_WIDTH - 1)
+
+ObjTrieMap* emptyTrieMap();
+bool trieMapGet(ObjTrieMap* map, Value key, Value* value);
+ObjTrieMap* trieMapPut(ObjTrieMap* map, Value key, Value value);
+ObjTrieMap* trieMapRemove(ObjTrieMap* map, Value key);
+
+ObjList* emptyList();
+Value listGet(ObjList* list, int index);
+ObjList* listPush(ObjList* list, Value value);
+ObjList* listPut(ObjList* list, int index, Value value);
+
+void printTrieMap(ObjTrieMap* map);
+void printList(ObjList* list);
+
+#endif
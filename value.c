@@ -14,8 +14,9 @@ void initValueArray(ValueArray* array) {
 void writeValueArray(ValueArray* array, Value value) {
   if (array->capacity < array->count + 1) {
     int oldCapacity = array->capacity;
-    array->capacity = GROW_CAPACITY(oldCapacity);
-    array->values = GROW_ARRAY(Value, array->values, oldCapacity, array->capacity);
+    int capacity = GROW_CAPACITY(oldCapacity);
+    array->values = GROW_ARRAY(Value, array->values, oldCapacity, capacity);
+    array->capacity = capacity;
   }
 
   array->values[array->count] = value;
@@ -26,6 +27,15 @@ void freeValueArray(ValueArray* array) {
   FREE_ARRAY(Value, array->values, array->capacity);
   initValueArray(array);
 }
+// whole numbers print every digit, the same whether they are integers or doubles
+static void printNumber(double number) {
+  if (number > -9007199254740992.0 && number < 9007199254740992.0 && number == (long long)number) {
+    printf("%.0f", number);
+  } else {
+    printf("%g", number);
+  }
+}
+
 void printValue(Value value) {
 #ifdef NAN_BOXING
   if (IS_BOOL(value)) {
@@ -34,8 +44,13 @@ void printValue(Value value) {
     printf(AS_EFFECT(value) ? "done" : "fail");
   } else if (IS_NIL(value)) {
     printf("null");
+  } else if (IS_INTEGER(value)) {
+    printf("%d", AS_INTEGER(value));
   } else if (IS_NUMBER(value)) {
-    printf("%g", AS_NUMBER(value));
+    printNumber(AS_NUMBER(value));
+  } else if (IS_SMALL_STRING(value)) {
+    char chars[SMALL_STRING_MAX];
+    printf("%.*s", smallStringChars(value, chars), chars);
   } else if (IS_OBJ(value)) {
     printObject(value);
   }
@@ -58,7 +73,7 @@ void printValue(Value value) {
         printf("null");
         break;
     case VAL_NUMBER:
-        printf("%g", AS_NUMBER(value));
+        printNumber(AS_NUMBER(value));
         break;
 //> Strings call-print-object
     case VAL_OBJ:
@@ -71,12 +86,37 @@ void printValue(Value value) {
 #endif
 }
 
+// equal values hash the same, text by its chars and other objects by identity
+uint32_t hashValue(Value value) {
+  if (IS_TEXT(value)) return textHash(value);
+  uint64_t bits;
+  if (IS_NUMBER(value)) {
+    double number = AS_NUMBER(value);
+    if (number == 0) return 0; // 0 and -0 are the same key
+    memcpy(&bits, &number, sizeof(bits));
+  } else if (IS_OBJ(value)) {
+    bits = (uint64_t)(uintptr_t)AS_OBJ(value);
+  } else if (IS_BOOL(value)) {
+    bits = AS_BOOL(value) ? 3 : 5;
+  } else if (IS_EFFECT(value)) {
+    bits = AS_EFFECT(value) ? 7 : 11;
+  } else {
+    bits = 13; // nil
+  }
+  bits ^= bits >> 33;
+  bits *= 0xff51afd7ed558ccdULL;
+  bits ^= bits >> 33;
+  return (uint32_t)bits;
+}
+
+// both values must be reachable, a rope is flattened before comparing
 bool valuesEqual(Value a, Value b) {
 #ifdef NAN_BOXING
   if (IS_NUMBER(a) && IS_NUMBER(b)) {
     return AS_NUMBER(a) == AS_NUMBER(b);
   }
-  return a == b;
+  if (a == b) return true;
+  return IS_TEXT(a) && IS_TEXT(b) && textsEqual(a, b);
 #else
 //< Optimization values-equal
   if (a.type != b.type) return false;
@@ -95,7 +135,9 @@ bool valuesEqual(Value a, Value b) {
     }
  */
 //> Hash Tables equal
-    case VAL_OBJ:    return AS_OBJ(a) == AS_OBJ(b);
+    case VAL_OBJ:
+      if (AS_OBJ(a) == AS_OBJ(b)) return true;
+      return IS_TEXT(a) && IS_TEXT(b) && textsEqual(a, b);
 //< Hash Tables equal
     default:         return false; // Unreachable.
   }
@@ -9,6 +9,8 @@ typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 //^ Strings forward-declare-obj
 
+#define SMALL_STRING_MAX 6
+
 //> Optimization nan-boxing
 #ifdef NAN_BOXING
 
@@ -22,22 +24,32 @@ typedef struct ObjString ObjString;
 #define TAG_FAIL  4
 #define TAG_DONE  5
 
+// a string of up to SMALL_STRING_MAX chars held in the payload, low byte first
+#define SMALL_STRING_BIT ((uint64_t)0x0002000000000000)
+// an int32 in the low half of the payload, a number that skips the float unit
+#define INTEGER_BIT      ((uint64_t)0x0001000000000000)
+
 typedef uint64_t Value;
 
 // is ...
-#define IS_NUMBER(value)(((value) & QNAN) != QNAN)
-  //^ If the NaN bits exist then NaN
+#define IS_NUMBER(value)isNumber(value)
+  //^ If the NaN bits exist then NaN, unless it is an integer
+#define IS_INTEGER(value) \
+    (((value) & (SIGN_BIT | QNAN | SMALL_STRING_BIT | INTEGER_BIT)) == (QNAN | INTEGER_BIT))
 #define IS_OBJ(value)   (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
   //^ object pointer is a NaN with set sign bit
 #define IS_BOOL(value)  (((value) | 1) == TRUE_VAL)
 #define IS_EFFECT(value) (((value) | 1)== DONE_VAL)
 #define IS_NIL(value)   ((value) == NIL_VAL)
+#define IS_SMALL_STRING(value) \
+    (((value) & (SIGN_BIT | QNAN | SMALL_STRING_BIT)) == (QNAN | SMALL_STRING_BIT))
 
 // as ...
 #define AS_BOOL(value)  ((value) == TRUE_VAL)
 #define AS_EFFECT(value)((value) == DONE_VAL)
 #define AS_OBJ(value)   ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
 #define AS_NUMBER(value)valueToNum(value)
+#define AS_INTEGER(value)((int32_t)(uint32_t)(value))
 
 // value ...
 #define BOOL_VAL(b)     ((b) ? TRUE_VAL : FALSE_VAL)
@@ -48,10 +60,15 @@ typedef uint64_t Value;
 #define DONE_VAL        ((Value)(uint64_t)(QNAN | TAG_DONE))
 #define NIL_VAL         ((Value)(uint64_t)(QNAN | TAG_NIL))
 #define NUMBER_VAL(num) numToValue(num)
+#define INTEGER_VAL(i)  ((Value)(QNAN | INTEGER_BIT | (uint32_t)(int32_t)(i)))
 #define OBJ_VAL(obj) \
     (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
 
+static inline bool isNumber(Value value) {
+  return (value & QNAN) != QNAN || IS_INTEGER(value);
+}
 static inline double valueToNum(Value value) {
+  if (IS_INTEGER(value)) return AS_INTEGER(value);
   double number;
   memcpy(&number, &value, sizeof(Value));
   return number;
@@ -62,6 +79,35 @@ static inline Value numToValue(double number) {
   return value;
 }
 
+/*
+  The chars are zero padded, so a small string cannot hold a NUL and its
+  length is where the padding starts. Text that fits is always small,
+  equal small strings are equal Values.
+*/
+static inline bool fitsSmallString(const char* chars, int length) {
+  return length <= SMALL_STRING_MAX && memchr(chars, '\0', length) == NULL;
+}
+static inline Value smallStringVal(const char* chars, int length) {
+  uint64_t bits = 0;
+  for (int i = 0; i < length; i++) {
+    bits |= (uint64_t)(uint8_t)chars[i] << (8 * i);
+  }
+  return (Value)(QNAN | SMALL_STRING_BIT | bits);
+}
+static inline int smallStringLength(Value value) {
+  int length = 0;
+  while (length < SMALL_STRING_MAX && ((value >> (8 * length)) & 0xff) != 0) length++;
+  return length;
+}
+// copies the chars out, not NUL terminated
+static inline int smallStringChars(Value value, char* chars) {
+  int length = smallStringLength(value);
+  for (int i = 0; i < length; i++) {
+    chars[i] = (char)(value >> (8 * i));
+  }
+  return length;
+}
+
 #else
 
 //< Optimization nan-boxing
@@ -90,22 +136,32 @@ typedef struct {
 #define IS_EFFECT(value)  ((value).type == VAL_EFFECT)
 #define IS_NIL(value)     ((value).type == VAL_NIL)
 #define IS_NUMBER(value)  ((value).type == VAL_NUMBER)
+#define IS_INTEGER(value) false
 #define IS_OBJ(value)     ((value).type == VAL_OBJ)
+#define IS_SMALL_STRING(value) false
 //^ Strings is-obj
 
 // as macros
 #define AS_OBJ(value)     ((value).as.obj)
 #define AS_BOOL(value)    ((value).as.boolean)
-#define AS_EFFECT(valu)   ((value).as.effect)
+#define AS_EFFECT(value)  ((value).as.effect)
 #define AS_NUMBER(value)  ((value).as.number)
+#define AS_INTEGER(value) ((int32_t)(value).as.number)
 
 #define BOOL_VAL(value)   ((Value){VAL_BOOL, {.boolean = value}})
 #define EFFECT_VAL(value) ((Value){VAL_EFFECT, {.effect = value}})
 #define NIL_VAL           ((Value){VAL_NIL, {.number = 0}})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
+#define INTEGER_VAL(value) NUMBER_VAL((double)(value)) // every number is a double here
 #define OBJ_VAL(object)   ((Value){VAL_OBJ, {.obj = (Obj*)object}})
 //^ Strings obj-val
 
+// small strings need the spare NaN bits, every string is an object here
+static inline bool fitsSmallString(const char* chars, int length) { return false; }
+static inline Value smallStringVal(const char* chars, int length) { return NIL_VAL; }
+static inline int smallStringLength(Value value) { return 0; }
+static inline int smallStringChars(Value value, char* chars) { return 0; }
+
 #endif
 //^ Optimization end-if-nan-boxing
 
@@ -115,7 +171,14 @@ typedef struct {
   Value* values;
 } ValueArray;
 
+// an integer Value while whole falls in int32, a double past it
+static inline Value wholeNumberVal(long long whole) {
+  if (whole >= INT32_MIN && whole <= INT32_MAX) return INTEGER_VAL(whole);
+  return NUMBER_VAL((double)whole);
+}
+
 //> array-fns-h
+uint32_t hashValue(Value value);
 bool valuesEqual(Value a, Value b);
 void initValueArray(ValueArray* array);
 void writeValueArray(ValueArray* array, Value value);
@@ -0,0 +1,231 @@
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define VECTOR_X86
+#include <immintrin.h>
+#endif
+
+#include "vector.h"
+
+//> Scalar kernels, every CPU and the tail of the wider ones
+static void addScalar(const double* a, const double* b, double* out, int length) {
+  for (int i = 0; i < length; i++) out[i] = a[i] + b[i];
+}
+
+static void multiplyScalar(const double* a, const double* b, double* out, int length) {
+  for (int i = 0; i < length; i++) out[i] = a[i] * b[i];
+}
+
+static void scaleScalar(const double* a, double factor, double* out, int length) {
+  for (int i = 0; i < length; i++) out[i] = a[i] * factor;
+}
+
+static double dotScalar(const double* a, const double* b, int length) {
+  double total = 0;
+  for (int i = 0; i < length; i++) total += a[i] * b[i];
+  return total;
+}
+
+static double sumScalar(const double* a, int length) {
+  double total = 0;
+  for (int i = 0; i < length; i++) total += a[i];
+  return total;
+}
+
+static double minScalar(const double* a, int length) {
+  double least = a[0];
+  for (int i = 1; i < length; i++) least = a[i] < least ? a[i] : least;
+  return least;
+}
+
+static double maxScalar(const double* a, int length) {
+  double most = a[0];
+  for (int i = 1; i < length; i++) most = a[i] > most ? a[i] : most;
+  return most;
+}
+//^ Scalar kernels
+
+#ifdef VECTOR_X86
+//> SSE2 kernels, two doubles at a time, always there on x86-64
+static void addSSE2(const double* a, const double* b, double* out, int length) {
+  int i = 0;
+  for (; i + 2 <= length; i += 2) {
+    _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  }
+  addScalar(a + i, b + i, out + i, length - i);
+}
+
+static void multiplySSE2(const double* a, const double* b, double* out, int length) {
+  int i = 0;
+  for (; i + 2 <= length; i += 2) {
+    _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  }
+  multiplyScalar(a + i, b + i, out + i, length - i);
+}
+
+static void scaleSSE2(const double* a, double factor, double* out, int length) {
+  __m128d factors = _mm_set1_pd(factor);
+  int i = 0;
+  for (; i + 2 <= length; i += 2) {
+    _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(a + i), factors));
+  }
+  scaleScalar(a + i, factor, out + i, length - i);
+}
+
+static double addLanesSSE2(__m128d lanes) {
+  double parts[2];
+  _mm_storeu_pd(parts, lanes);
+  return parts[0] + parts[1];
+}
+
+static double dotSSE2(const double* a, const double* b, int length) {
+  __m128d total = _mm_setzero_pd();
+  int i = 0;
+  for (; i + 2 <= length; i += 2) {
+    total = _mm_add_pd(total, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  }
+  return addLanesSSE2(total) + dotScalar(a + i, b + i, length - i);
+}
+
+static double sumSSE2(const double* a, int length) {
+  __m128d total = _mm_setzero_pd();
+  int i = 0;
+  for (; i + 2 <= length; i += 2) {
+    total = _mm_add_pd(total, _mm_loadu_pd(a + i));
+  }
+  return addLanesSSE2(total) + sumScalar(a + i, length - i);
+}
+
+// the lanes start out holding the first items, there is no identity to seed them with
+static double minSSE2(const double* a, int length) {
+  if (length < 2) return minScalar(a, length);
+  __m128d lanes = _mm_loadu_pd(a);
+  int i = 2;
+  for (; i + 2 <= length; i += 2) {
+    lanes = _mm_min_pd(_mm_loadu_pd(a + i), lanes);
+  }
+  double parts[2];
+  _mm_storeu_pd(parts, lanes);
+  double least = minScalar(parts, 2);
+  for (; i < length; i++) least = a[i] < least ? a[i] : least;
+  return least;
+}
+
+static double maxSSE2(const double* a, int length) {
+  if (length < 2) return maxScalar(a, length);
+  __m128d lanes = _mm_loadu_pd(a);
+  int i = 2;
+  for (; i + 2 <= length; i += 2) {
+    lanes = _mm_max_pd(_mm_loadu_pd(a + i), lanes);
+  }
+  double parts[2];
+  _mm_storeu_pd(parts, lanes);
+  double most = maxScalar(parts, 2);
+  for (; i < length; i++) most = a[i] > most ? a[i] : most;
+  return most;
+}
+//^ SSE2 kernels
+
+//> AVX2 kernels, four doubles at a time, only called once the CPU says it has them
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static void addAVX2(const double* a, const double* b, double* out, int length) {
+  int i = 0;
+  for (; i + 4 <= length; i += 4) {
+    _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+  }
+  addSSE2(a + i, b + i, out + i, length - i);
+}
+
+AVX2 static void multiplyAVX2(const double* a, const double* b, double* out, int length) {
+  int i = 0;
+  for (; i + 4 <= length; i += 4) {
+    _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+  }
+  multiplySSE2(a + i, b + i, out + i, length - i);
+}
+
+AVX2 static void scaleAVX2(const double* a, double factor, double* out, int length) {
+  __m256d factors = _mm256_set1_pd(factor);
+  int i = 0;
+  for (; i + 4 <= length; i += 4) {
+    _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), factors));
+  }
+  scaleSSE2(a + i, factor, out + i, length - i);
+}
+
+AVX2 static double addLanesAVX2(__m256d lanes) {
+  double parts[4];
+  _mm256_storeu_pd(parts, lanes);
+  return (parts[0] + parts[1]) + (parts[2] + parts[3]);
+}
+
+AVX2 static double dotAVX2(const double* a, const double* b, int length) {
+  __m256d total = _mm256_setzero_pd();
+  int i = 0;
+  for (; i + 4 <= length; i += 4) {
+    total = _mm256_add_pd(total, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+  }
+  return addLanesAVX2(total) + dotSSE2(a + i, b + i, length - i);
+}
+
+AVX2 static double sumAVX2(const double* a, int length) {
+  __m256d total = _mm256_setzero_pd();
+  int i = 0;
+  for (; i + 4 <= length; i += 4) {
+    total = _mm256_add_pd(total, _mm256_loadu_pd(a + i));
+  }
+  return addLanesAVX2(total) + sumSSE2(a + i, length - i);
+}
+
+AVX2 static double minAVX2(const double* a, int length) {
+  if (length < 4) return minSSE2(a, length);
+  __m256d lanes = _mm256_loadu_pd(a);
+  int i = 4;
+  for (; i + 4 <= length; i += 4) {
+    lanes = _mm256_min_pd(_mm256_loadu_pd(a + i), lanes);
+  }
+  double parts[4];
+  _mm256_storeu_pd(parts, lanes);
+  double least = minScalar(parts, 4);
+  for (; i < length; i++) least = a[i] < least ? a[i] : least;
+  return least;
+}
+
+AVX2 static double maxAVX2(const double* a, int length) {
+  if (length < 4) return maxSSE2(a, length);
+  __m256d lanes = _mm256_loadu_pd(a);
+  int i = 4;
+  for (; i + 4 <= length; i += 4) {
+    lanes = _mm256_max_pd(_mm256_loadu_pd(a + i), lanes);
+  }
+  double parts[4];
+  _mm256_storeu_pd(parts, lanes);
+  double most = maxScalar(parts, 4);
+  for (; i < length; i++) most = a[i] > most ? a[i] : most;
+  return most;
+}
+
+#undef AVX2
+//^ AVX2 kernels
+#endif
+
+VectorKernels vectorKernels = {
+  "scalar", addScalar, multiplyScalar, scaleScalar,
+  dotScalar, sumScalar, minScalar, maxScalar
+};
+
+void initVectorKernels() {
+#ifdef VECTOR_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    vectorKernels = (VectorKernels){
+      "avx2", addAVX2, multiplyAVX2, scaleAVX2,
+      dotAVX2, sumAVX2, minAVX2, maxAVX2
+    };
+  } else {
+    vectorKernels = (VectorKernels){
+      "sse2", addSSE2, multiplySSE2, scaleSSE2,
+      dotSSE2, sumSSE2, minSSE2, maxSSE2
+    };
+  }
+#endif
+}
@@ -0,0 +1,26 @@
+#ifndef mu_vector_h
+#define mu_vector_h
+
+#include "common.h"
+
+/*
+  Loops over unboxed doubles for the vector natives. initVectorKernels
+  picks the widest set the CPU running the interpreter supports, the
+  same script gets the same answers from each up to rounding.
+*/
+typedef struct {
+  const char* name;
+  void (*add)(const double* a, const double* b, double* out, int length);
+  void (*multiply)(const double* a, const double* b, double* out, int length);
+  void (*scale)(const double* a, double factor, double* out, int length);
+  double (*dot)(const double* a, const double* b, int length);
+  double (*sum)(const double* a, int length);
+  double (*min)(const double* a, int length); // length is at least 1
+  double (*max)(const double* a, int length);
+} VectorKernels;
+
+extern VectorKernels vectorKernels;
+
+void initVectorKernels();
+
+#endif
@@ -1,3 +1,5 @@
+#include <ctype.h>
+#include <limits.h>
 #include <stdarg.h> // Types of Values include-stdarg
 #include <stdio.h>  // vm-include-stdio
 #include <string.h> // Strings vm-include-string
@@ -5,8 +7,11 @@
 #include "common.h"
 #include "compiler.h" // Scanning on Demand vm-include-compiler
 #include "disassemble.h" // vm-include-debug
+#include "map.h"
 #include "object.h" // Strings
 #include "memory.h" // Strings
+#include "trie.h"
+#include "vector.h"
 #include "vm.h"
 #include "builtins.h"
 
@@ -42,12 +47,252 @@ static void runtimeError(const char* format, ...) {
 
 //> Native Functions
 static void defineNative(const char* name, NativeFn function) {
-  push(OBJ_VAL(copyString(name, (int)strlen(name))));
+  push(copyText(name, (int)strlen(name)));
   push(OBJ_VAL(newNative(function)));
-  tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
+  tableSet(&vm.globals, vm.stack[0], vm.stack[1]);
   pop();
   pop();
 }
+
+//> Text natives, misuse returns fail
+// a whole number that fits an int, checked before the cast
+static bool isIndex(Value value) {
+  return IS_NUMBER(value) && AS_NUMBER(value) >= 0 && AS_NUMBER(value) <= INT_MAX
+      && AS_NUMBER(value) == (double)(int)AS_NUMBER(value);
+}
+
+// slice(text, start, count), shares the chars of text
+static Value sliceNative(int argCount, Value* args) {
+  if (argCount != 3 || !IS_TEXT(args[0]) || !isIndex(args[1]) || !isIndex(args[2])) {
+    return EFFECT_VAL(false);
+  }
+  int start = (int)AS_NUMBER(args[1]);
+  int count = (int)AS_NUMBER(args[2]);
+  int length = textLength(args[0]);
+  if (start > length || count > length - start) return EFFECT_VAL(false); // start + count may overflow
+  return sliceText(args[0], start, count);
+}
+
+// indexOf(text, part, from), where part next starts or -1
+static Value indexOfNative(int argCount, Value* args) {
+  if (argCount != 3 || !IS_TEXT(args[0]) || !IS_TEXT(args[1]) || !isIndex(args[2])) {
+    return EFFECT_VAL(false);
+  }
+  int length = textLength(args[0]);
+  int partLength = textLength(args[1]);
+  char textSmall[SMALL_STRING_MAX];
+  char partSmall[SMALL_STRING_MAX];
+  const char* chars = textChars(args[0], textSmall);
+  const char* part = textChars(args[1], partSmall);
+
+  for (int i = (int)AS_NUMBER(args[2]); i + partLength <= length; i++) {
+    if (memcmp(chars + i, part, partLength) == 0) return INTEGER_VAL(i);
+  }
+  return INTEGER_VAL(-1);
+}
+
+// trim(text), without the surrounding whitespace
+static Value trimNative(int argCount, Value* args) {
+  if (argCount != 1 || !IS_TEXT(args[0])) return EFFECT_VAL(false);
+  int end = textLength(args[0]);
+  char small[SMALL_STRING_MAX];
+  const char* chars = textChars(args[0], small);
+
+  int start = 0;
+  while (start < end && isspace((unsigned char)chars[start])) start++;
+  while (end > start && isspace((unsigned char)chars[end - 1])) end--;
+  return sliceText(args[0], start, end - start);
+}
+//^ Text natives
+
+//> Array natives
+// append(array, value), adds value at the end and gives back the array
+static Value appendNative(int argCount, Value* args) {
+  if (argCount != 2 || !IS_ARRAY(args[0])) return EFFECT_VAL(false);
+  ObjArray* array = AS_ARRAY(args[0]);
+  if (vm.hasCheckpoint && !array->obj.inArena) return EFFECT_VAL(false);
+  writeValueArray(&array->items, args[1]);
+  return args[0];
+}
+//^ Array natives
+
+//> Map natives
+// has(map, key)
+static Value hasNative(int argCount, Value* args) {
+  Value value;
+  if (argCount != 2 || !IS_MAP(args[0])) return EFFECT_VAL(false);
+  return BOOL_VAL(mapGet(AS_MAP(args[0]), args[1], &value));
+}
+
+// remove(map, key), whether key was there
+static Value removeNative(int argCount, Value* args) {
+  if (argCount != 2 || !IS_MAP(args[0])) return EFFECT_VAL(false);
+  ObjMap* map = AS_MAP(args[0]);
+  if (vm.hasCheckpoint && !map->obj.inArena) return EFFECT_VAL(false);
+  return BOOL_VAL(mapRemove(map, args[1]));
+}
+
+// an array of the keys, or of the values, in the order they were added
+static Value mapItems(int argCount, Value* args, bool keys) {
+  if (argCount != 1 || !IS_MAP(args[0])) return EFFECT_VAL(false);
+  ObjMap* map = AS_MAP(args[0]);
+  ObjArray* array = newArray(map->count);
+  for (int i = 0; i < map->used; i++) {
+    MapEntry* entry = &map->entries[i];
+    if (IS_NIL(entry->key)) continue;
+    array->items.values[array->items.count++] = keys ? entry->key : entry->value;
+  }
+  return OBJ_VAL(array);
+}
+
+static Value keysNative(int argCount, Value* args) {
+  return mapItems(argCount, args, true);
+}
+
+static Value valuesNative(int argCount, Value* args) {
+  return mapItems(argCount, args, false);
+}
+//^ Map natives
+
+//> Persistent natives
+// list() or list(array), a persistent list of the array's items
+static Value listNative(int argCount, Value* args) {
+  if (argCount > 1 || (argCount == 1 && !IS_ARRAY(args[0]))) return EFFECT_VAL(false);
+  push(OBJ_VAL(emptyList()));
+  if (argCount == 1) {
+    ValueArray* items = &AS_ARRAY(args[0])->items;
+    for (int i = 0; i < items->count; i++) {
+      vm.stackTop[-1] = OBJ_VAL(listPush(AS_LIST(vm.stackTop[-1]), items->values[i]));
+    }
+  }
+  return pop();
+}
+
+// listPush(list, value), a new list one longer
+static Value listPushNative(int argCount, Value* args) {
+  if (argCount != 2 || !IS_LIST(args[0])) return EFFECT_VAL(false);
+  return OBJ_VAL(listPush(AS_LIST(args[0]), args[1]));
+}
+
+// listPut(list, index, value), a new list with index changed
+static Value listPutNative(int argCount, Value* args) {
+  if (argCount != 3 || !IS_LIST(args[0]) || !isIndex(args[1])
+      || AS_NUMBER(args[1]) >= AS_LIST(args[0])->count) {
+    return EFFECT_VAL(false);
+  }
+  return OBJ_VAL(listPut(AS_LIST(args[0]), (int)AS_NUMBER(args[1]), args[2]));
+}
+
+// hashMap(), an empty persistent map
+static Value hashMapNative(int argCount, Value* args) {
+  (void)args; // takes no arguments
+  if (argCount != 0) return EFFECT_VAL(false);
+  return OBJ_VAL(emptyTrieMap());
+}
+
+// mapPut(map, key, value), a new map with key set
+static Value mapPutNative(int argCount, Value* args) {
+  if (argCount != 3 || !IS_TRIE_MAP(args[0])) return EFFECT_VAL(false);
+  return OBJ_VAL(trieMapPut(AS_TRIE_MAP(args[0]), args[1], args[2]));
+}
+
+// mapRemove(map, key), a new map without key
+static Value mapRemoveNative(int argCount, Value* args) {
+  if (argCount != 2 || !IS_TRIE_MAP(args[0])) return EFFECT_VAL(false);
+  return OBJ_VAL(trieMapRemove(AS_TRIE_MAP(args[0]), args[1]));
+}
+
+// mapGet(map, key), fail when key is not there
+static Value mapGetNative(int argCount, Value* args) {
+  Value value;
+  if (argCount != 2 || !IS_TRIE_MAP(args[0])
+      || !trieMapGet(AS_TRIE_MAP(args[0]), args[1], &value)) {
+    return EFFECT_VAL(false);
+  }
+  return value;
+}
+
+static Value mapHasNative(int argCount, Value* args) {
+  Value value;
+  if (argCount != 2 || !IS_TRIE_MAP(args[0])) return EFFECT_VAL(false);
+  return BOOL_VAL(trieMapGet(AS_TRIE_MAP(args[0]), args[1], &value));
+}
+//^ Persistent natives
+
+//> Vector natives
+// vector(array) of its numbers, or vector(length, fill)
+static Value vectorNative(int argCount, Value* args) {
+  if (argCount == 2 && isIndex(args[0]) && IS_NUMBER(args[1])) {
+    ObjVector* vector = newVector((int)AS_NUMBER(args[0]));
+    for (int i = 0; i < vector->length; i++) vector->values[i] = AS_NUMBER(args[1]);
+    return OBJ_VAL(vector);
+  }
+  if (argCount != 1 || !IS_ARRAY(args[0])) return EFFECT_VAL(false);
+  ValueArray* items = &AS_ARRAY(args[0])->items;
+  for (int i = 0; i < items->count; i++) {
+    if (!IS_NUMBER(items->values[i])) return EFFECT_VAL(false);
+  }
+  ObjVector* vector = newVector(items->count);
+  for (int i = 0; i < items->count; i++) vector->values[i] = AS_NUMBER(items->values[i]);
+  return OBJ_VAL(vector);
+}
+
+static bool sameLengthVectors(int argCount, Value* args) {
+  return argCount == 2 && IS_VECTOR(args[0]) && IS_VECTOR(args[1])
+      && AS_VECTOR(args[0])->length == AS_VECTOR(args[1])->length;
+}
+
+static Value vectorAddNative(int argCount, Value* args) {
+  if (!sameLengthVectors(argCount, args)) return EFFECT_VAL(false);
+  ObjVector* result = newVector(AS_VECTOR(args[0])->length);
+  vectorKernels.add(AS_VECTOR(args[0])->values, AS_VECTOR(args[1])->values,
+      result->values, result->length);
+  return OBJ_VAL(result);
+}
+
+static Value vectorMultiplyNative(int argCount, Value* args) {
+  if (!sameLengthVectors(argCount, args)) return EFFECT_VAL(false);
+  ObjVector* result = newVector(AS_VECTOR(args[0])->length);
+  vectorKernels.multiply(AS_VECTOR(args[0])->values, AS_VECTOR(args[1])->values,
+      result->values, result->length);
+  return OBJ_VAL(result);
+}
+
+// vectorScale(vector, factor)
+static Value vectorScaleNative(int argCount, Value* args) {
+  if (argCount != 2 || !IS_VECTOR(args[0]) || !IS_NUMBER(args[1])) return EFFECT_VAL(false);
+  ObjVector* result = newVector(AS_VECTOR(args[0])->length);
+  vectorKernels.scale(AS_VECTOR(args[0])->values, AS_NUMBER(args[1]),
+      result->values, result->length);
+  return OBJ_VAL(result);
+}
+
+static Value vectorDotNative(int argCount, Value* args) {
+  if (!sameLengthVectors(argCount, args)) return EFFECT_VAL(false);
+  ObjVector* a = AS_VECTOR(args[0]);
+  return NUMBER_VAL(vectorKernels.dot(a->values, AS_VECTOR(args[1])->values, a->length));
+}
+
+static Value vectorSumNative(int argCount, Value* args) {
+  if (argCount != 1 || !IS_VECTOR(args[0])) return EFFECT_VAL(false);
+  return NUMBER_VAL(vectorKernels.sum(AS_VECTOR(args[0])->values, AS_VECTOR(args[0])->length));
+}
+
+// an empty vector has no least or greatest item
+static Value vectorMinNative(int argCount, Value* args) {
+  if (argCount != 1 || !IS_VECTOR(args[0]) || AS_VECTOR(args[0])->length == 0) {
+    return EFFECT_VAL(false);
+  }
+  return NUMBER_VAL(vectorKernels.min(AS_VECTOR(args[0])->values, AS_VECTOR(args[0])->length));
+}
+
+static Value vectorMaxNative(int argCount, Value* args) {
+  if (argCount != 1 || !IS_VECTOR(args[0]) || AS_VECTOR(args[0])->length == 0) {
+    return EFFECT_VAL(false);
+  }
+  return NUMBER_VAL(vectorKernels.max(AS_VECTOR(args[0])->values, AS_VECTOR(args[0])->length));
+}
+//^ Vector natives
 //^ Native Functions
 
 void initVM() {
@@ -55,7 +300,16 @@ void initVM() {
   vm.objects = NULL;
 // GC
   vm.bytesAllocated = 0;
-  vm.nextGC = 1024 * 1024;
+  vm.gcConfig.initialHeap = 1024 * 1024;
+  vm.gcConfig.heapLimit = 0;
+  vm.gcConfig.growFactor = 2;
+  vm.gcConfig.minGrowFactor = 1.5;
+  vm.gcConfig.maxGrowFactor = 8;
+  vm.gcConfig.gcTimeTarget = 0.05;
+  vm.heapGrowFactor = vm.gcConfig.growFactor;
+  vm.nextGC = vm.gcConfig.initialHeap;
+  vm.lastCollection = clock();
+  vm.memoryError = NULL;
   vm.grayCount = 0;
   vm.grayCapacity = 0;
   vm.grayStack = NULL;
@@ -68,12 +322,89 @@ void initVM() {
   vm.initString = NULL;
   vm.initString = copyString("init", 4);
 
+  defineNative("slice", sliceNative);
+  defineNative("indexOf", indexOfNative);
+  defineNative("trim", trimNative);
+  defineNative("append", appendNative);
+  defineNative("has", hasNative);
+  defineNative("remove", removeNative);
+  defineNative("keys", keysNative);
+  defineNative("values", valuesNative);
+  defineNative("list", listNative);
+  defineNative("listPush", listPushNative);
+  defineNative("listPut", listPutNative);
+  defineNative("hashMap", hashMapNative);
+  defineNative("mapPut", mapPutNative);
+  defineNative("mapRemove", mapRemoveNative);
+  defineNative("mapGet", mapGetNative);
+  defineNative("mapHas", mapHasNative);
+  initVectorKernels();
+  defineNative("vector", vectorNative);
+  defineNative("vectorAdd", vectorAddNative);
+  defineNative("vectorMultiply", vectorMultiplyNative);
+  defineNative("vectorScale", vectorScaleNative);
+  defineNative("vectorDot", vectorDotNative);
+  defineNative("vectorSum", vectorSumNative);
+  defineNative("vectorMin", vectorMinNative);
+  defineNative("vectorMax", vectorMaxNative);
   // defineNative("clock", clockNative);
   // defineNative("squareRoot", handleSqrt);
   // defineNative("show", handlePrint);
 }
 
+void configureGC(const GCConfig* config) {
+  vm.gcConfig = *config;
+  vm.heapGrowFactor = config->growFactor;
+  vm.nextGC = vm.bytesAllocated > config->initialHeap
+      ? vm.bytesAllocated : config->initialHeap;
+  if (config->heapLimit != 0 && vm.nextGC > config->heapLimit) {
+    vm.nextGC = config->heapLimit;
+  }
+}
+
+/*
+  Request checkpoints, for hosts that run many short scripts on one VM.
+  After markCheckpoint() nothing is collected, every allocation comes out
+  of vm.requestArena instead. resetToCheckpoint() throws all of it away at
+  once by rewinding that arena and putting back the globals and interned
+  strings saved at the checkpoint, no object is visited.
+
+  Objects from before the checkpoint must not be made to point at objects
+  made after it, those references would dangle after the reset.
+*/
+void markCheckpoint() {
+  if (vm.hasCheckpoint) dropCheckpoint();
+
+  snapshotTable(&vm.globals, &vm.checkpointGlobals);
+  snapshotTable(&vm.strings, &vm.checkpointStrings);
+  vm.hasCheckpoint = true;
+  vm.arena = &vm.requestArena;
+}
+
+void resetToCheckpoint() {
+  if (!vm.hasCheckpoint) return;
+
+  resetStack();
+  restoreTable(&vm.globals, &vm.checkpointGlobals);
+  restoreTable(&vm.strings, &vm.checkpointStrings);
+  resetArena(&vm.requestArena);
+}
+
+// goes back to the checkpoint for good, and to collecting garbage
+void dropCheckpoint() {
+  if (!vm.hasCheckpoint) return;
+
+  resetToCheckpoint();
+  vm.arena = NULL;
+  vm.hasCheckpoint = false;
+  freeArena(&vm.requestArena);
+  freeSnapshot(&vm.checkpointGlobals);
+  freeSnapshot(&vm.checkpointStrings);
+}
+
 void freeVM() {
+  dropCheckpoint();
+  freeArena(&vm.compilerArena);
   freeTable(&vm.globals);
   freeTable(&vm.strings);
   vm.initString = NULL;
@@ -91,6 +422,20 @@ static Value peek(int distance) {
   return vm.stackTop[-1 - distance];
 }
 
+// the closure's frame over its arguments, the arity was already checked
+static inline bool pushFrame(ObjClosure* closure, int argCount) {
+  if (vm.frameCount == FRAMES_MAX) {
+    runtimeError("Stack overflow.");
+    return false;
+  }
+//^ check-overflow
+  CallFrame* frame = &vm.frames[vm.frameCount++];
+  frame->closure = closure;
+  frame->ip = closure->function->chunk.code;
+  frame->slots = vm.stackTop - argCount - 1;
+  return true;
+}
+
 static bool call(ObjClosure* closure, int argCount) {
 // Closures check-arity
   if (argCount != closure->function->arity) {
@@ -99,31 +444,272 @@ static bool call(ObjClosure* closure, int argCount) {
     return false;
   }
 //^ check-arity
-  if (vm.frameCount == FRAMES_MAX) {
-    runtimeError("Stack overflow.");
+  return pushFrame(closure, argCount);
+}
+
+// the native's result takes the place of it and its arguments
+static inline void callNative(NativeFn native, int argCount) {
+  Value result = native(argCount, vm.stackTop - argCount);
+  vm.stackTop -= argCount + 1;
+  push(result);
+}
+
+//> Instance fields
+/*
+  Finds name's slot through the site's cache, filling a way on a miss.
+  A chunk from before a checkpoint never remembers a request's structure,
+  the arena may hand its address to another one after the reset.
+*/
+static int cachedSlot(PropertyCache* cache, ObjClass* definition, Value name) {
+  for (int way = 0; way < CACHE_WAYS; way++) {
+    if (cache->definitions[way] == definition) return cache->slots[way];
+  }
+
+  int slot = fieldSlot(definition, name);
+  ObjFunction* function = vm.frames[vm.frameCount - 1].closure->function;
+  if (slot == -1 || (definition->obj.inArena && !function->obj.inArena)) return slot;
+
+  // newest first, the oldest way falls off
+  for (int way = CACHE_WAYS - 1; way > 0; way--) {
+    cache->definitions[way] = cache->definitions[way - 1];
+    cache->slots[way] = cache->slots[way - 1];
+  }
+  cache->definitions[0] = definition;
+  cache->slots[0] = slot;
+  return slot;
+}
+
+// the field's slot in receiver, NULL cache for a lookup that is not cached
+static int findField(Value receiver, Value name, PropertyCache* cache) {
+  char small[SMALL_STRING_MAX];
+  if (!IS_INSTANCE(receiver)) {
+    runtimeError("Only instances have fields.");
+    return -1;
+  }
+  ObjClass* definition = AS_INSTANCE(receiver)->definition;
+  int slot = cache != NULL ? cachedSlot(cache, definition, name) : fieldSlot(definition, name);
+  if (slot == -1) {
+    runtimeError("Undefined field '%.*s'.", textLength(name), textChars(name, small));
+  }
+  return slot;
+}
+
+// stores the top of the stack into field slot of the instance below it, only #fields get here
+static bool setField(int slot) {
+  ObjInstance* instance = AS_INSTANCE(peek(1));
+  if (vm.hasCheckpoint && !instance->obj.inArena) {
+    runtimeError("Can't change an instance made before the checkpoint.");
     return false;
   }
-//^ check-overflow
-  CallFrame* frame = &vm.frames[vm.frameCount++];
-  frame->closure = closure;
-  frame->ip = closure->function->chunk.code;
-  frame->slots = vm.stackTop - argCount - 1;
+  instance->fields[slot] = peek(0);
+  return true;
+}
+
+// Point(1, 2, 3), the arguments fill the fields in declaration order
+static bool construct(ObjClass* definition, int argCount) {
+  if (argCount != definition->fieldCount) {
+    runtimeError("Expected %d arguments but got %d.", definition->fieldCount, argCount);
+    return false;
+  }
+  ObjInstance* instance = newInstance(definition);
+  memcpy(instance->fields, vm.stackTop - argCount, sizeof(Value) * argCount);
+  vm.stackTop -= argCount;
+  vm.stackTop[-1] = OBJ_VAL(instance);
   return true;
 }
+//^ Instance fields
+
+//> Arrays
+// [a, b, c], the items are the top count values on the stack
+static void buildArray(int count) {
+  ObjArray* array = newArray(count);
+  if (count > 0) memcpy(array->items.values, vm.stackTop - count, sizeof(Value) * count);
+  array->items.count = count;
+  vm.stackTop -= count;
+  push(OBJ_VAL(array));
+}
+
+// { key: value }, the keys and values are the top count pairs on the stack
+static bool buildMap(int count) {
+  ObjMap* map = newMap();
+  push(OBJ_VAL(map));
+  reserveMap(map, count);
+  Value* pairs = vm.stackTop - 1 - 2 * count;
+  for (int i = 0; i < count; i++) {
+    if (IS_NIL(pairs[2 * i])) {
+      runtimeError("Map keys can't be null.");
+      return false;
+    }
+    mapSet(map, pairs[2 * i], pairs[2 * i + 1]);
+  }
+  vm.stackTop -= 2 * count + 1;
+  push(OBJ_VAL(map));
+  return true;
+}
+
+// a whole number inside [0, length)
+static bool checkIndex(Value index, int length, int* position) {
+  if (IS_INTEGER(index) && AS_INTEGER(index) >= 0 && AS_INTEGER(index) < length) {
+    *position = AS_INTEGER(index);
+    return true;
+  }
+  if (!IS_NUMBER(index)) {
+    runtimeError("Index must be a number.");
+    return false;
+  }
+  double number = AS_NUMBER(index);
+  if (!(number >= 0 && number < length)) {
+    runtimeError("Index %g is out of bounds for length %d.", number, length);
+    return false;
+  }
+  if (number != (int)number) {
+    runtimeError("Index %g is not a whole number.", number);
+    return false;
+  }
+  *position = (int)number;
+  return true;
+}
+
+// receiver[index], an item of an array or a one character text
+static bool getIndex() {
+  Value receiver = peek(1);
+  int position;
+  if (IS_ARRAY(receiver)) {
+    ValueArray* items = &AS_ARRAY(receiver)->items;
+    if (!checkIndex(peek(0), items->count, &position)) return false;
+    vm.stackTop -= 2;
+    push(items->values[position]);
+    return true;
+  }
+  if (IS_MAP(receiver)) {
+    Value value;
+    if (!mapGet(AS_MAP(receiver), peek(0), &value)) {
+      runtimeError("Key not found.");
+      return false;
+    }
+    vm.stackTop -= 2;
+    push(value);
+    return true;
+  }
+  if (IS_LIST(receiver)) {
+    if (!checkIndex(peek(0), AS_LIST(receiver)->count, &position)) return false;
+    Value item = listGet(AS_LIST(receiver), position);
+    vm.stackTop -= 2;
+    push(item);
+    return true;
+  }
+  if (IS_VECTOR(receiver)) {
+    ObjVector* vector = AS_VECTOR(receiver);
+    if (!checkIndex(peek(0), vector->length, &position)) return false;
+    vm.stackTop -= 2;
+    push(NUMBER_VAL(vector->values[position]));
+    return true;
+  }
+  if (IS_TEXT(receiver)) {
+    if (!checkIndex(peek(0), textLength(receiver), &position)) return false;
+    Value character = sliceText(receiver, position, 1);
+    vm.stackTop -= 2;
+    push(character);
+    return true;
+  }
+  runtimeError("Only arrays, maps, lists, vectors and text can be indexed.");
+  return false;
+}
+
+// receiver[key] := value, the map stays on the stack while it grows
+static bool setKey() {
+  ObjMap* map = AS_MAP(peek(2));
+  if (vm.hasCheckpoint && !map->obj.inArena) {
+    runtimeError("Can't change a map made before the checkpoint.");
+    return false;
+  }
+  if (IS_NIL(peek(1))) {
+    runtimeError("Map keys can't be null.");
+    return false;
+  }
+  mapSet(map, peek(1), peek(0));
+  Value value = pop();
+  vm.stackTop -= 2;
+  push(value);
+  return true;
+}
+
+// receiver[index] := value, leaves value
+static bool setIndex() {
+  Value receiver = peek(2);
+  if (IS_MAP(receiver)) return setKey();
+  if (!IS_ARRAY(receiver)) {
+    runtimeError("Only array and map items can be assigned.");
+    return false;
+  }
+  ObjArray* array = AS_ARRAY(receiver);
+  if (vm.hasCheckpoint && !array->obj.inArena) {
+    runtimeError("Can't change an array made before the checkpoint.");
+    return false;
+  }
+  int position;
+  if (!checkIndex(peek(1), array->items.count, &position)) return false;
+  array->items.values[position] = peek(0);
+  Value value = pop();
+  vm.stackTop -= 2;
+  push(value);
+  return true;
+}
+
+// .length of an array, list, map, vector or text, an instance's own length field otherwise
+static bool getLength() {
+  Value receiver = peek(0);
+  if (IS_ARRAY(receiver)) {
+    vm.stackTop[-1] = INTEGER_VAL(AS_ARRAY(receiver)->items.count);
+  } else if (IS_MAP(receiver)) {
+    vm.stackTop[-1] = INTEGER_VAL(AS_MAP(receiver)->count);
+  } else if (IS_LIST(receiver)) {
+    vm.stackTop[-1] = INTEGER_VAL(AS_LIST(receiver)->count);
+  } else if (IS_TRIE_MAP(receiver)) {
+    vm.stackTop[-1] = INTEGER_VAL(AS_TRIE_MAP(receiver)->count);
+  } else if (IS_VECTOR(receiver)) {
+    vm.stackTop[-1] = INTEGER_VAL(AS_VECTOR(receiver)->length);
+  } else if (IS_TEXT(receiver)) {
+    vm.stackTop[-1] = INTEGER_VAL(textLength(receiver));
+  } else {
+    int slot = findField(receiver, copyText("length", 6), NULL);
+    if (slot == -1) return false;
+    vm.stackTop[-1] = AS_INSTANCE(receiver)->fields[slot];
+  }
+  return true;
+}
+//^ Arrays
+
+// where a when's OP_SWITCH goes for subject, nil when none of its arms match
+static Value switchTarget(Value table, Value subject) {
+  Value target = NIL_VAL;
+  if (IS_MAP(table)) {
+    mapGet(AS_MAP(table), subject, &target);
+    return target;
+  }
+  ValueArray* targets = &AS_ARRAY(table)->items; // the lowest key, then a target per key from it
+  int64_t low = AS_INTEGER(targets->values[0]);
+  if (IS_INTEGER(subject)) {
+    int64_t position = AS_INTEGER(subject) - low + 1;
+    return position >= 1 && position < targets->count ? targets->values[position] : NIL_VAL;
+  }
+  if (!IS_NUMBER(subject)) return NIL_VAL;
+  double position = AS_NUMBER(subject) - low + 1;
+  if (!(position >= 1 && position < targets->count) || position != (int)position) return NIL_VAL;
+  return targets->values[(int)position];
+}
 
 static bool callValue(Value callee, int argCount) {
   if (IS_OBJ(callee)) {
     switch (OBJ_TYPE(callee)) {
 
+      case OBJ_CLASS:
+        return construct(AS_CLASS(callee), argCount);
       case OBJ_CLOSURE:
         return call(AS_CLOSURE(callee), argCount);
-      case OBJ_NATIVE: {
-        NativeFn native = AS_NATIVE(callee);
-        Value result = native(argCount, vm.stackTop - argCount);
-        vm.stackTop -= argCount + 1;
-        push(result);
+      case OBJ_NATIVE:
+        callNative(AS_NATIVE(callee), argCount);
         return true;
-      }
       default:
         break; // Non-callable object type.
     }
@@ -132,6 +718,20 @@ static bool callValue(Value callee, int argCount) {
   return false;
 }
 
+/*
+  Remembers the callee of a call that went through, so the site's next
+  call to it skips the dispatch. Structures still construct the slow way.
+  A site from before a checkpoint never remembers a request's callee, as
+  with the property caches.
+*/
+static void cacheCall(CallCache* cache, Value callee, ObjFunction* site) {
+  if (!IS_CLOSURE(callee) && !IS_NATIVE(callee)) return;
+  if (AS_OBJ(callee)->inArena && !site->obj.inArena) return;
+  cache->callee = AS_OBJ(callee);
+  cache->isNative = IS_NATIVE(callee);
+}
+
+
 static ObjUpvalue* captureUpvalue(Value* local) {
   ObjUpvalue* prevUpvalue = NULL;
   ObjUpvalue* upvalue = vm.openUpvalues;
@@ -168,21 +768,115 @@ static bool isFalsey(Value value) {
   return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
-static void concatenate() {
-  ObjString* b = AS_STRING(peek(0)); // Garbage Collection concatenate-peek
-  ObjString* a = AS_STRING(peek(1)); // Garbage Collection concatenate-peek
+/*
+  Short results are copied out right away, the shortest need no heap at all. Anything longer becomes a rope,
+  so building text up piece by piece stays linear. Ropes are never shorter
+  than ROPE_MIN_LENGTH, so both operands of a copy are contiguous.
+*/
+#define ROPE_MIN_LENGTH 64
 
-  int length = a->length + b->length;
-  char* chars = ALLOCATE(char, length + 1);
-  memcpy(chars, a->chars, a->length);
-  memcpy(chars + a->length, b->chars, b->length);
-  chars[length] = '\0';
+static void concatenate() {
+  Value right = peek(0); // Garbage Collection concatenate-peek
+  Value left = peek(1);
+  int length = textLength(left) + textLength(right);
+  Value result;
 
-  ObjString* result = takeString(chars, length);
+  if (length < ROPE_MIN_LENGTH) {
+    char chars[ROPE_MIN_LENGTH];
+    char small[SMALL_STRING_MAX];
+    int split = textLength(left);
+    memcpy(chars, textChars(left, small), split);
+    memcpy(chars + split, textChars(right, small), length - split);
+    result = newText(chars, length);
+  } else {
+    result = OBJ_VAL(newRope(left, right, length));
+  }
 
   pop(); // Garbage Collection concatenate-pop
   pop(); // Garbage Collection concatenate-pop
-  push(OBJ_VAL(result));
+  push(result);
+}
+
+//> In place, the compound assignments to a local
+// *target += by, the same as OP_ADD
+static bool addInPlace(Value* target, Value by) {
+  int32_t result;
+  if (IS_INTEGER(*target) && IS_INTEGER(by)
+      && !__builtin_add_overflow(AS_INTEGER(*target), AS_INTEGER(by), &result)) {
+    *target = INTEGER_VAL(result);
+    return true;
+  }
+  if (!IS_NUMBER(*target) || !IS_NUMBER(by)) {
+    runtimeError("Operands must be numbers.");
+    return false;
+  }
+  *target = NUMBER_VAL(AS_NUMBER(*target) + AS_NUMBER(by));
+  return true;
+}
+
+static bool multiplyInPlace(Value* target, Value by) {
+  int32_t result;
+  if (IS_INTEGER(*target) && IS_INTEGER(by)
+      && !__builtin_mul_overflow(AS_INTEGER(*target), AS_INTEGER(by), &result)) {
+    *target = INTEGER_VAL(result);
+    return true;
+  }
+  if (!IS_NUMBER(*target) || !IS_NUMBER(by)) {
+    runtimeError("Operands must be numbers.");
+    return false;
+  }
+  *target = NUMBER_VAL(AS_NUMBER(*target) * AS_NUMBER(by));
+  return true;
+}
+
+// takes its operand off the top of the stack, where it stays reachable while the two are joined
+static bool concatenateInPlace(Value* target) {
+  if (!IS_TEXT(*target) || !IS_TEXT(peek(0))) {
+    runtimeError("Operands must be two strings, Or two integers.");
+    return false;
+  }
+  Value by = peek(0);
+  vm.stackTop[-1] = *target;
+  push(by);
+  concatenate();
+  *target = pop();
+  return true;
+}
+//^ In place
+
+/*
+  Joins the top count values. A short result is laid out with a single
+  allocation. A long one is folded into ropes in place
+  on the stack, so every partial result stays reachable.
+*/
+static void concatenateMany(int count) {
+  Value* operands = vm.stackTop - count;
+  int length = 0;
+  for (int i = 0; i < count; i++) {
+    length += textLength(operands[i]);
+  }
+
+  if (length < ROPE_MIN_LENGTH) {
+    char chars[ROPE_MIN_LENGTH];
+    char small[SMALL_STRING_MAX];
+    int next = 0;
+    for (int i = 0; i < count; i++) {
+      int part = textLength(operands[i]);
+      memcpy(chars + next, textChars(operands[i], small), part);
+      next += part;
+    }
+    operands[count - 1] = newText(chars, length);
+  } else {
+    int joined = textLength(operands[0]);
+    for (int i = 1; i < count; i++) {
+      joined += textLength(operands[i]);
+      operands[i] = OBJ_VAL(newRope(operands[i - 1], operands[i], joined));
+    }
+  }
+
+  Value result = operands[count - 1];
+  vm.stackTop = operands;
+  push(result);
 }
 
 static InterpretResult run() {
@@ -196,28 +890,41 @@ static InterpretResult run() {
 #define READ_CONSTANT() \
     (frame->closure->function->chunk.constantPool.values[READ_BYTE()])
 
-#define READ_STRING() AS_STRING(READ_CONSTANT())
+#define READ_NAME() READ_CONSTANT() // small string or interned ObjString
+
+#define READ_CACHE() (&frame->closure->function->chunk.caches[READ_SHORT()])
 
-/* TODO replace with actual integer type, actual float type */
-#define UNARY_INT_OP(valueType, op) \
+#define READ_CALL_CACHE() (&frame->closure->function->chunk.callCaches[READ_SHORT()])
+
+// integers in, integer out, anything else goes through long long as before
+#define UNARY_INT_OP(op) \
     do { \
+      if (IS_INTEGER(peek(0))) { \
+        vm.stackTop[-1] = INTEGER_VAL(op AS_INTEGER(peek(0))); \
+        break; \
+      } \
       if (!IS_NUMBER(peek(0))) { \
         runtimeError("Operand must be a number."); \
         return INTERPRET_RUNTIME_ERROR; \
       } \
       long long value = AS_NUMBER(pop()); \
-      push(valueType(op value)); \
+      push(wholeNumberVal(op value)); \
     } while (false)
 
-#define BINARY_INT_OP(valueType, op) \
+#define BINARY_INT_OP(op) \
     do { \
+      if (IS_INTEGER(peek(0)) && IS_INTEGER(peek(1))) { \
+        long long b = AS_INTEGER(pop()); \
+        vm.stackTop[-1] = wholeNumberVal(AS_INTEGER(peek(0)) op b); \
+        break; \
+      } \
       if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
         runtimeError("Operands must be numbers."); \
         return INTERPRET_RUNTIME_ERROR; \
       } \
       long long b = AS_NUMBER(pop()); \
       long long a = AS_NUMBER(pop()); \
-      push(valueType(a op b)); \
+      push(wholeNumberVal(a op b)); \
     } while (false)
 
 #define BINARY_OP(valueType, op) \
@@ -231,6 +938,51 @@ static InterpretResult run() {
       push(valueType(a op b)); \
     } while (false)
 
+/*
+  Two integers stay integers unless the result overflows int32, then
+  it is worked out in doubles like any other pair of numbers.
+*/
+#define INTEGER_OP(op, checkedOp) \
+    do { \
+      if (IS_INTEGER(peek(0)) && IS_INTEGER(peek(1))) { \
+        int32_t result; \
+        if (!checkedOp(AS_INTEGER(peek(1)), AS_INTEGER(peek(0)), &result)) { \
+          vm.stackTop--; \
+          vm.stackTop[-1] = INTEGER_VAL(result); \
+          break; \
+        } \
+      } \
+      BINARY_OP(NUMBER_VAL, op); \
+    } while (false)
+
+#define COMPARE_OP(op) \
+    do { \
+      if (IS_INTEGER(peek(0)) && IS_INTEGER(peek(1))) { \
+        bool result = AS_INTEGER(peek(1)) op AS_INTEGER(peek(0)); \
+        vm.stackTop--; \
+        vm.stackTop[-1] = BOOL_VAL(result); \
+        break; \
+      } \
+      BINARY_OP(BOOL_VAL, op); \
+    } while (false)
+
+// pops both numbers and jumps when a op b comes out as jumpWhen
+#define COMPARE_JUMP(op, jumpWhen) \
+    do { \
+      uint16_t offset = READ_SHORT(); \
+      bool result; \
+      if (IS_INTEGER(peek(0)) && IS_INTEGER(peek(1))) { \
+        result = AS_INTEGER(peek(1)) op AS_INTEGER(peek(0)); \
+      } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) { \
+        result = AS_NUMBER(peek(1)) op AS_NUMBER(peek(0)); \
+      } else { \
+        runtimeError("Operands must be numbers."); \
+        return INTERPRET_RUNTIME_ERROR; \
+      } \
+      vm.stackTop -= 2; \
+      if (result == (jumpWhen)) frame->ip += offset; \
+    } while (false)
+
 #define APPEND_INTEGER(valueType, op) \
     do { \
       if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
@@ -299,27 +1051,60 @@ static InterpretResult run() {
         frame->slots[slot] = peek(0);
         break;
       }
+      case OP_ADD_LOCAL: {
+        Value* slot = &frame->slots[READ_BYTE()];
+        if (!addInPlace(slot, pop())) return INTERPRET_RUNTIME_ERROR;
+        break;
+      }
+      case OP_ADD_LOCAL_CONSTANT: {
+        Value* slot = &frame->slots[READ_BYTE()];
+        if (!addInPlace(slot, READ_CONSTANT())) return INTERPRET_RUNTIME_ERROR;
+        break;
+      }
+      case OP_MULTIPLY_LOCAL: {
+        Value* slot = &frame->slots[READ_BYTE()];
+        if (!multiplyInPlace(slot, pop())) return INTERPRET_RUNTIME_ERROR;
+        break;
+      }
+      case OP_MULTIPLY_LOCAL_CONSTANT: {
+        Value* slot = &frame->slots[READ_BYTE()];
+        if (!multiplyInPlace(slot, READ_CONSTANT())) return INTERPRET_RUNTIME_ERROR;
+        break;
+      }
+      case OP_CONCATENATE_LOCAL: {
+        Value* slot = &frame->slots[READ_BYTE()];
+        if (!concatenateInPlace(slot)) return INTERPRET_RUNTIME_ERROR;
+        break;
+      }
+      case OP_CONCATENATE_LOCAL_CONSTANT: {
+        Value* slot = &frame->slots[READ_BYTE()];
+        push(READ_CONSTANT());
+        if (!concatenateInPlace(slot)) return INTERPRET_RUNTIME_ERROR;
+        break;
+      }
       case OP_GET_GLOBAL: {
-        ObjString* name = READ_STRING();
+        Value name = READ_NAME();
         Value value;
         if (!tableGet(&vm.globals, name, &value)) {
-          runtimeError("Undefined variable '%s'.", name->chars);
+          char small[SMALL_STRING_MAX];
+          runtimeError("Undefined variable '%.*s'.", textLength(name), textChars(name, small));
           return INTERPRET_RUNTIME_ERROR;
         }
         push(value);
         break;
       }
       case OP_SET_GLOBAL: {
-        ObjString* name = READ_STRING();
+        Value name = READ_NAME();
         if (tableSet(&vm.globals, name, peek(0))) {
           tableDelete(&vm.globals, name);
-          runtimeError("Undefined variable '%s'.", name->chars);
+          char small[SMALL_STRING_MAX];
+          runtimeError("Undefined variable '%.*s'.", textLength(name), textChars(name, small));
           return INTERPRET_RUNTIME_ERROR;
         }
         break;
       }
       case OP_DEFINE_GLOBAL: {
-        ObjString* name = READ_STRING();
+        Value name = READ_NAME();
         tableSet(&vm.globals, name, peek(0));
         pop();
         break;
@@ -336,37 +1121,47 @@ static InterpretResult run() {
       }
 // Binary Operations
       case OP_EQUAL: {
-        Value b = pop();
-        Value a = pop();
-        push(BOOL_VAL(valuesEqual(a, b)));
+        bool equal = valuesEqual(peek(1), peek(0)); // may flatten, keep both rooted
+        vm.stackTop -= 2;
+        push(BOOL_VAL(equal));
         break;
       }
-      case OP_GREATER:  BINARY_OP(BOOL_VAL, >);
+      case OP_GREATER:  COMPARE_OP(>);
         break;
-      case OP_LESS:     BINARY_OP(BOOL_VAL, <);
+      case OP_LESS:     COMPARE_OP(<);
         break;
-      case OP_ADD:      BINARY_OP(NUMBER_VAL, +);
+      case OP_ADD:      INTEGER_OP(+, __builtin_add_overflow);
         break;
-      case OP_SUBTRACT: BINARY_OP(NUMBER_VAL, -);
+      case OP_SUBTRACT: INTEGER_OP(-, __builtin_sub_overflow);
         break;
-      case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *);
+      case OP_MULTIPLY: INTEGER_OP(*, __builtin_mul_overflow);
         break;
       case OP_DIVIDE:   BINARY_OP(NUMBER_VAL, /);
         break;
-      case OP_MODULO:   BINARY_INT_OP(NUMBER_VAL, %);
+      case OP_MODULO:
+        if (IS_NUMBER(peek(0)) && (long long)AS_NUMBER(peek(0)) == 0) {
+          runtimeError("Modulo by zero.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        BINARY_INT_OP(%);
         break;
-      case OP_BIT_AND:  BINARY_INT_OP(NUMBER_VAL, &);
+      case OP_BIT_AND:  BINARY_INT_OP(&);
         break;
-      case OP_BIT_OR:   BINARY_INT_OP(NUMBER_VAL, |);
+      case OP_BIT_OR:   BINARY_INT_OP(|);
         break;
-      case OP_BIT_XOR:  BINARY_INT_OP(NUMBER_VAL, ^);
+      case OP_BIT_XOR:  BINARY_INT_OP(^);
         break;
-      case OP_FLIP_BITS: UNARY_INT_OP(NUMBER_VAL, ~);
+      case OP_FLIP_BITS: UNARY_INT_OP(~);
         break;
       case OP_NOT:
         push(BOOL_VAL(isFalsey(pop())));
         break;
       case OP_NEGATE:
+        // INT32_MIN has no int32 negation, and 0 negates to the double -0
+        if (IS_INTEGER(peek(0)) && AS_INTEGER(peek(0)) != 0 && AS_INTEGER(peek(0)) != INT32_MIN) {
+          vm.stackTop[-1] = INTEGER_VAL(-AS_INTEGER(peek(0)));
+          break;
+        }
         if (!IS_NUMBER(peek(0))) {
           runtimeError("Operand must be a number.");
           return INTERPRET_RUNTIME_ERROR;
@@ -374,12 +1169,13 @@ static InterpretResult run() {
         push(NUMBER_VAL(-AS_NUMBER(pop())));
         break;
       case OP_PRINT: {
-        printValue(pop());
+        printValue(peek(0));
         printf("\n");
+        pop();
         break;
       }
       case OP_CONCATENATE : {
-        if (IS_STRING(peek(1)) && IS_STRING(peek(0))) {
+        if (IS_TEXT(peek(1)) && IS_TEXT(peek(0))) {
           concatenate();
         }
        // else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) { APPEND_INTEGER(NUMBER_VAL, +);}
@@ -389,6 +1185,17 @@ static InterpretResult run() {
         }
       }
         break;
+      case OP_CONCATENATE_N: {
+        int count = READ_BYTE();
+        for (int i = 0; i < count; i++) {
+          if (!IS_TEXT(peek(i))) {
+            runtimeError("Operands must be strings.");
+            return INTERPRET_RUNTIME_ERROR;
+          }
+        }
+        concatenateMany(count);
+        break;
+      }
       case OP_JUMP: {
         uint16_t offset = READ_SHORT();
         frame->ip += offset;
@@ -404,25 +1211,178 @@ static InterpretResult run() {
         if (!isFalsey(peek(0))) frame->ip += offset;
         break;
       }
+      case OP_POP_JUMP_IF_FALSE: {
+        uint16_t offset = READ_SHORT();
+        if (isFalsey(pop())) frame->ip += offset;
+        break;
+      }
+      case OP_POP_JUMP_IF_TRUE: {
+        uint16_t offset = READ_SHORT();
+        if (!isFalsey(pop())) frame->ip += offset;
+        break;
+      }
+      case OP_JUMP_IF_LESS:         COMPARE_JUMP(<, true);
+        break;
+      case OP_JUMP_IF_NOT_LESS:     COMPARE_JUMP(<, false);
+        break;
+      case OP_JUMP_IF_GREATER:      COMPARE_JUMP(>, true);
+        break;
+      case OP_JUMP_IF_NOT_GREATER:  COMPARE_JUMP(>, false);
+        break;
+      case OP_JUMP_IF_EQUAL:
+      case OP_JUMP_IF_NOT_EQUAL: {
+        uint16_t offset = READ_SHORT();
+        bool equal = valuesEqual(peek(1), peek(0)); // may flatten, keep both rooted
+        vm.stackTop -= 2;
+        if (equal == (instruction == OP_JUMP_IF_EQUAL)) frame->ip += offset;
+        break;
+      }
       case OP_LOOP: {
         uint16_t offset = READ_SHORT(); // Calls and Functions loop
         frame->ip -= offset;
         break;
       }
-      case OP_QUIT: {
-        do {
-          instruction = READ_BYTE();
-        } while (instruction != OP_QUIT_END);
+      case OP_FOR_STEP: {
+        Value* counter = &frame->slots[READ_BYTE()];
+        Value step = READ_CONSTANT();
+        uint8_t compare = READ_BYTE();
+        bool expect = READ_BYTE();
+        uint16_t offset = READ_SHORT();
+        Value limit = pop();
+        if (!addInPlace(counter, step)) return INTERPRET_RUNTIME_ERROR;
+
+        bool result;
+        if (IS_INTEGER(*counter) && IS_INTEGER(limit)) {
+          result = compare == OP_LESS ? AS_INTEGER(*counter) < AS_INTEGER(limit)
+                                      : AS_INTEGER(*counter) > AS_INTEGER(limit);
+        } else if (IS_NUMBER(limit)) {
+          result = compare == OP_LESS ? AS_NUMBER(*counter) < AS_NUMBER(limit)
+                                      : AS_NUMBER(*counter) > AS_NUMBER(limit);
+        } else {
+          runtimeError("Operands must be numbers.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        if (result == expect) frame->ip -= offset;
+        break;
+      }
+      case OP_SWITCH: {
+        Value table = READ_CONSTANT();
+        uint16_t miss = READ_SHORT();
+        Value target = switchTarget(table, peek(0));
+        pop();
+        if (IS_NIL(target)) {
+          frame->ip += miss;
+        } else {
+          frame->ip = frame->closure->function->chunk.code + AS_INTEGER(target);
+        }
         break;
       }
       case OP_CALL: {
         int argCount = READ_BYTE();
-        if (!callValue(peek(argCount), argCount)) {
-          return INTERPRET_RUNTIME_ERROR;
+        CallCache* cache = READ_CALL_CACHE();
+        Value callee = peek(argCount);
+        if (IS_OBJ(callee) && AS_OBJ(callee) == cache->callee) {
+          if (cache->isNative) {
+            callNative(((ObjNative*)cache->callee)->function, argCount);
+            break;
+          }
+          if (!pushFrame((ObjClosure*)cache->callee, argCount)) return INTERPRET_RUNTIME_ERROR;
+        } else {
+          ObjFunction* site = frame->closure->function;
+          if (!callValue(callee, argCount)) {
+            return INTERPRET_RUNTIME_ERROR;
+          }
+          cacheCall(cache, callee, site);
         }
         frame = &vm.frames[vm.frameCount - 1]; // after call, update the frame
         break;
       }
+      case OP_INVOKE: {
+        Value name = READ_NAME();
+        PropertyCache* cache = READ_CACHE();
+        int argCount = READ_BYTE();
+        Value receiver = peek(argCount);
+        int slot = findField(receiver, name, cache);
+        if (slot == -1) return INTERPRET_RUNTIME_ERROR;
+
+        Value field = AS_INSTANCE(receiver)->fields[slot];
+        vm.stackTop[-argCount - 1] = field; // the field's function is called in place of the instance
+        if (!callValue(field, argCount)) {
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        frame = &vm.frames[vm.frameCount - 1];
+        break;
+      }
+      case OP_CLASS: {
+        Value name = READ_NAME();
+        int fieldCount = READ_BYTE();
+        ObjClass* definition = newClass(name, fieldCount);
+        for (int i = 0; i < fieldCount; i++) {
+          definition->fields[i] = READ_NAME();
+        }
+        push(OBJ_VAL(definition));
+        break;
+      }
+      case OP_GET_PROPERTY: {
+        Value name = READ_NAME();
+        int slot = findField(peek(0), name, READ_CACHE());
+        if (slot == -1) return INTERPRET_RUNTIME_ERROR;
+        vm.stackTop[-1] = AS_INSTANCE(peek(0))->fields[slot];
+        break;
+      }
+      case OP_SET_PROPERTY: {
+        Value name = READ_NAME();
+        int slot = findField(peek(1), name, READ_CACHE());
+        if (slot == -1 || !setField(slot)) return INTERPRET_RUNTIME_ERROR;
+        Value value = pop();
+        vm.stackTop[-1] = value;
+        break;
+      }
+      /*
+        The compiler knew the receiver's structure. It still has to be
+        one with name at that index, or the field is looked up by name.
+      */
+      case OP_GET_FIELD: {
+        int slot = READ_BYTE();
+        Value name = READ_NAME();
+        Value receiver = peek(0);
+        if (!IS_INSTANCE(receiver) || slot >= AS_INSTANCE(receiver)->fieldCount
+            || !SAME_KEY(AS_INSTANCE(receiver)->definition->fields[slot], name)) {
+          slot = findField(receiver, name, NULL);
+          if (slot == -1) return INTERPRET_RUNTIME_ERROR;
+        }
+        vm.stackTop[-1] = AS_INSTANCE(receiver)->fields[slot];
+        break;
+      }
+      case OP_SET_FIELD: {
+        int slot = READ_BYTE();
+        Value name = READ_NAME();
+        Value receiver = peek(1);
+        if (!IS_INSTANCE(receiver) || slot >= AS_INSTANCE(receiver)->fieldCount
+            || !SAME_KEY(AS_INSTANCE(receiver)->definition->fields[slot], name)) {
+          slot = findField(receiver, name, NULL);
+          if (slot == -1) return INTERPRET_RUNTIME_ERROR;
+        }
+        if (!setField(slot)) return INTERPRET_RUNTIME_ERROR;
+        Value value = pop();
+        vm.stackTop[-1] = value;
+        break;
+      }
+      case OP_ARRAY:
+        buildArray(READ_BYTE());
+        break;
+      case OP_GET_INDEX:
+        if (!getIndex()) return INTERPRET_RUNTIME_ERROR;
+        break;
+      case OP_SET_INDEX:
+        if (!setIndex()) return INTERPRET_RUNTIME_ERROR;
+        break;
+      case OP_LENGTH:
+        if (!getLength()) return INTERPRET_RUNTIME_ERROR;
+        break;
+      case OP_MAP:
+        if (!buildMap(READ_BYTE())) return INTERPRET_RUNTIME_ERROR;
+        break;
       case OP_CLOSURE: {
         ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
         ObjClosure* closure = newClosure(function);
@@ -462,16 +1422,38 @@ static InterpretResult run() {
 #undef READ_BYTE
 #undef READ_SHORT
 #undef READ_CONSTANT
-#undef READ_STRING
+#undef READ_NAME
+#undef READ_CACHE
 #undef BINARY_OP
 #undef BINARY_INT_OP
+#undef INTEGER_OP
+#undef COMPARE_OP
+#undef COMPARE_JUMP
 #undef UNARY_INT_OP
 #undef APPEND_INTEGER
 }
 
 InterpretResult interpret(const char* source) {
+  jmp_buf memoryError;
+  if (setjmp(memoryError) != 0) { // unwound from reallocate
+    vm.memoryError = NULL;
+    vm.arena = vm.hasCheckpoint ? &vm.requestArena : NULL;
+    freeArena(&vm.compilerArena);
+    if (vm.gcConfig.heapLimit != 0) {
+      runtimeError("Out of memory, heap limit of %zu bytes reached.",
+          vm.gcConfig.heapLimit);
+    } else {
+      runtimeError("Out of memory.");
+    }
+    return INTERPRET_RUNTIME_ERROR;
+  }
+  vm.memoryError = &memoryError;
+
   ObjFunction* function = compile(source);
-  if (function == NULL) return INTERPRET_COMPILE_ERROR;
+  if (function == NULL) {
+    vm.memoryError = NULL;
+    return INTERPRET_COMPILE_ERROR;
+  }
 
   push(OBJ_VAL(function));
 
@@ -480,5 +1462,7 @@ InterpretResult interpret(const char* source) {
   push(OBJ_VAL(closure));
   call(closure, 0);
   printf("\n");
-  return run();
+  InterpretResult result = run();
+  vm.memoryError = NULL;
+  return result;
 }
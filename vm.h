@@ -1,6 +1,10 @@
 #ifndef mu_vm_h
 #define mu_vm_h
 
+#include <setjmp.h>
+#include <time.h>
+
+#include "arena.h"
 #include "object.h" // Calls and Functions vm-include-object
 #include "table.h"  // Hash Tables vm-include-table
 #include "value.h"  // vm-include-value
@@ -22,6 +26,17 @@ typedef struct {
 // } ProductType;
 //^ TESTING
 
+//> Garbage Collection tuning
+typedef struct {
+  size_t initialHeap;    // bytes allocated before the first collection
+  size_t heapLimit;      // hard ceiling on the heap, 0 means no ceiling
+  double growFactor;     // starting ratio of the next threshold to live bytes
+  double minGrowFactor;  // bounds the pacer keeps the grow factor within
+  double maxGrowFactor;
+  double gcTimeTarget;   // fraction of run time the collector may use, 0 disables pacing
+} GCConfig;
+//^ Garbage Collection tuning
+
 typedef struct {
   CallFrame frames[FRAMES_MAX]; // Array Calls and Functions
   int frameCount;               // Array Calls and Functions
@@ -34,6 +49,18 @@ typedef struct {
 //> Garbage Collection fields
   size_t bytesAllocated;
   size_t nextGC;
+  GCConfig gcConfig;
+  double heapGrowFactor; // current factor, adjusted by the pacer
+  clock_t lastCollection;
+  jmp_buf* memoryError; // where reallocate unwinds to when the heap limit is hit
+  Arena* arena;          // where reallocate takes memory from, NULL for the collected heap
+  Arena compilerArena;   // backs everything compile() allocates
+//> Request checkpoints
+  bool hasCheckpoint;
+  Arena requestArena;    // backs everything allocated after the checkpoint
+  TableSnapshot checkpointGlobals;
+  TableSnapshot checkpointStrings;
+//^ Request checkpoints
 // Strings Objects Root
   Obj* objects;
   int grayCount;
@@ -52,6 +79,10 @@ extern VM vm; // Strings extern-vm
 
 void initVM();
 void freeVM();
+void configureGC(const GCConfig* config);
+void markCheckpoint();
+void resetToCheckpoint();
+void dropCheckpoint();
 InterpretResult interpret(const char* source);
 void push(Value value);
 Value pop();